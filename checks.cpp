@@ -0,0 +1,409 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "xml.h"
+
+using namespace std;
+using namespace common::xml;
+
+static int failures = 0;
+
+static void Check(bool condition, const char* what)
+{
+    if (condition == false)
+    {
+        cout << "FAILED: " << what << endl;
+        failures++;
+    }
+}
+
+static void CheckEncoding()
+{
+    // An invalid byte close to the end of a chunk is rejected right away
+    {
+        XmlDocument doc;
+        XmlPushParser parser(&doc);
+        parser.ValidateEncoding(true);
+        Check(parser.Feed("<r><a\xFF>", 7) == false, "invalid byte at the end of a chunk");
+        Check(parser.Result().error == XmlParseInvalidEncoding, "invalid byte is an encoding error");
+        Check(parser.Result().offset == 5, "invalid byte offset");
+        Check(parser.Feed("x</a></r>", 9) == false, "no more input after an encoding error");
+    }
+
+    // A sequence split over two chunks is fine
+    {
+        XmlDocument doc;
+        XmlPushParser parser(&doc);
+        parser.ValidateEncoding(true);
+        Check(parser.Feed("<r>\xC3", 4), "first half of a sequence");
+        Check(parser.Feed("\xA9</r>", 5), "second half of a sequence");
+        Check(parser.Finish(), "split sequence");
+        Check(doc.DocumentElement() != 0 && doc.DocumentElement()->InnerText() == "\xC3\xA9", "split sequence text");
+    }
+
+    // A sequence that can not be completed fails without waiting for more input
+    {
+        XmlPushParser parser;
+        parser.ValidateEncoding(true);
+        Check(parser.Feed("<r>\xE0\x80", 5) == false, "overlong start at the end of a chunk");
+    }
+
+    // A sequence cut off by the end of the input
+    {
+        XmlPushParser parser;
+        parser.ValidateEncoding(true);
+        Check(parser.Feed("<r/>\xC3", 5), "trailing partial sequence");
+        Check(parser.Finish() == false && parser.Result().error == XmlParseInvalidEncoding, "partial sequence at the end");
+    }
+
+    {
+        XmlDocument doc;
+        XmlParseResult result;
+        doc.ValidateEncoding(true);
+        Check(doc.TryLoadXml("<r>\xED\xA0\x80</r>", result) == XmlParseInvalidEncoding, "surrogate rejected by TryLoadXml");
+    }
+
+    {
+        XmlDocument doc;
+        XmlParseResult result;
+        Check(doc.TryLoadXml("<r \xC3\xA9=\"1\">\xC3\xA9</r>", result) == XmlParseOk, "non-ascii names and text");
+        Check(doc.DocumentElement()->InnerText() == "\xC3\xA9", "non-ascii text is not whitespace");
+        Check(doc.DocumentElement()->Attributes().count("\xC3\xA9") == 1, "non-ascii attribute name");
+    }
+
+    // A leading byte order mark is skipped, also when it is split over chunks
+    {
+        XmlDocument doc;
+        XmlParseResult result;
+        doc.ValidateEncoding(true);
+        Check(doc.TryLoadXml("\xEF\xBB\xBF<r/>", result) == XmlParseOk, "byte order mark");
+
+        XmlDocument pushed;
+        XmlPushParser parser(&pushed);
+        parser.ValidateEncoding(true);
+        Check(parser.Feed("\xEF\xBB", 2) && parser.Feed("\xBF<r/>", 5) && parser.Finish(), "byte order mark, pushed");
+    }
+
+    // Entities are decoded on load and escaped again on output
+    {
+        XmlDocument doc;
+        XmlParseResult result;
+        Check(doc.TryLoadXml("<r a=\"&lt;&amp;&#65;\">x &gt; y</r>", result) == XmlParseOk, "entities load");
+        Check(doc.DocumentElement()->Attributes()["a"]->Value() == "<&A", "attribute entities");
+        Check(doc.DocumentElement()->InnerText() == "x > y", "text entities");
+        Check(doc.DocumentElement()->OuterXml() == "<r a=\"&lt;&amp;A\">x &gt; y</r>", "entities escaped");
+    }
+}
+
+static void WriteFile(const char* filename, const char* xml)
+{
+    ofstream ofs(filename);
+    ofs << xml;
+}
+
+static void CheckPush()
+{
+    // Every construct split at every possible point builds the same tree as LoadXml
+    {
+        const string xml = "<?xml version=\"1.0\"?>\n<r a=\"x &gt; y\" b=\"/>\"><!--c > d --><t>a &amp; b</t>"
+                           "<![CDATA[<z>&amp;]]><e f=\"&#65;\"/>tail</r>\n";
+        XmlDocument loaded;
+        XmlParseResult result;
+        Check(loaded.TryLoadXml(xml, result) == XmlParseOk, "push reference");
+
+        XmlDocument pushed;
+        XmlPushParser parser(&pushed);
+        bool parsed = true;
+        for (size_t i = 0; i < xml.size(); i++)
+            parsed = parsed && parser.Feed(&xml[i], 1);
+        Check(parsed && parser.Finish(), "byte by byte");
+        Check(pushed.DocumentElement() != 0 && pushed.DocumentElement()->OuterXml() == loaded.DocumentElement()->OuterXml(), "byte by byte tree");
+        Check(pushed._declaration != 0 && pushed._declaration->OuterXml() == loaded._declaration->OuterXml(), "byte by byte declaration");
+    }
+
+    // Processing instructions and doctypes are skipped, quotes in them mean nothing
+    {
+        XmlDocument doc;
+        XmlPushParser parser(&doc);
+        string xml = "<!DOCTYPE r [ <!ENTITY x \"y>\"> ]><r><?pi don't ?><a/></r>";
+        Check(parser.Feed(xml.c_str(), xml.size()) && parser.Finish(), "processing instruction with a quote");
+        Check(doc.DocumentElement() != 0 && doc.DocumentElement()->OuterXml() == "<r><a /></r>", "processing instruction skipped");
+    }
+
+    // Text outside the document element is an error, like in LoadXml
+    {
+        const char* inputs[] = { "garbage<r/>", "<r/>junk<!-- -->", "<r/>junk" };
+        for (size_t i = 0; i < sizeof(inputs) / sizeof(inputs[0]); i++)
+        {
+            XmlDocument doc;
+            XmlPushParser parser(&doc);
+            string xml = inputs[i];
+            Check((parser.Feed(xml.c_str(), xml.size()) && parser.Finish()) == false, "text outside the document element");
+        }
+    }
+}
+
+static void CheckCaches()
+{
+    XmlDocument doc;
+    XmlParseResult result;
+    doc.CacheOuterXml(true);
+    Check(doc.TryLoadXml("<r><a x=\"1\">1</a><b/></r>", result) == XmlParseOk, "cache source");
+    XmlNode* r = doc.DocumentElement();
+    XmlNode* a = r->ChildNodes()[0];
+    XmlNode* b = r->ChildNodes()[1];
+
+    // Every change below has to show in the cached output and hash of the root
+    string xml = r->OuterXml();
+    XmlHash hash = r->Hash();
+
+    a->Attributes()["x"]->Value("2");
+    Check(r->OuterXml() == "<r><a x=\"2\">1</a><b /></r>" && r->Hash() != hash, "attribute value change");
+    hash = r->Hash();
+
+    a->InnerText("3");
+    Check(r->OuterXml() == "<r><a x=\"2\">3</a><b /></r>" && r->Hash() != hash, "inner text change");
+    hash = r->Hash();
+
+    b->AppendChild(a);
+    Check(r->OuterXml() == "<r><b><a x=\"2\">3</a></b></r>" && r->Hash() != hash, "appended child");
+    hash = r->Hash();
+    xml = r->OuterXml();
+
+#ifdef COMMON_XML_EXCEPTIONS
+    // Malformed inner xml changes nothing
+    try
+    {
+        a->InnerXml("</zz>");
+        Check(false, "malformed inner xml throws");
+    }
+    catch (const string&)
+    { }
+    Check(a->ChildNodes().size() == 1 && r->OuterXml() == xml && r->Hash() == hash, "malformed inner xml keeps the node");
+#endif
+
+    a->InnerXml("<c/>");
+    Check(r->OuterXml() == "<r><b><a x=\"2\"><c /></a></b></r>" && r->Hash() != hash, "inner xml change");
+}
+
+static void CheckXPathCache()
+{
+    XmlDocument doc;
+    XmlParseResult result;
+    doc.XPathCacheSize(8);
+    Check(doc.TryLoadXml("<r><i/></r>", result) == XmlParseOk, "xpath cache source");
+    XmlNode* r = doc.DocumentElement();
+
+    Check(doc.SelectNodes("//i").size() == 1 && doc.SelectNodes("//i").size() == 1, "cached result");
+    Check(doc._xpathCache.size() == 1, "result is cached");
+
+    // Results are refreshed after every kind of change
+    r->AppendChild(r->ChildNodes()[0]->CloneNode(true));
+    Check(doc.SelectNodes("//i").size() == 2, "refreshed after AppendChild");
+
+    r->InnerXml("<i/><i/><i/>");
+    Check(doc.SelectNodes("//i").size() == 3 && doc.SelectSingleNode("//i") == r->ChildNodes()[0], "refreshed after InnerXml");
+
+    r->InnerText("none");
+    Check(doc.SelectNodes("//i").empty() && doc.SelectSingleNode("//i") == 0, "refreshed after InnerText");
+}
+
+static void CheckDiff()
+{
+    XmlDocument a, b, c, d;
+    XmlParseResult result;
+    Check(a.TryLoadXml("<r><a/><b/><c>1</c></r>", result) == XmlParseOk, "diff source");
+    Check(b.TryLoadXml("<r><b/><c>1</c></r>", result) == XmlParseOk, "diff removed");
+    Check(c.TryLoadXml("<r><a/><x/><b/><c>2</c></r>", result) == XmlParseOk, "diff added and changed");
+    Check(d.TryLoadXml("<r><a/><b/><c>1</c></r>", result) == XmlParseOk, "diff equal");
+
+    XmlNodeChangeList changes = a.Diff(b);
+    Check(changes.size() == 1 && changes[0].first == a.DocumentElement()->ChildNodes()[0] && changes[0].second == 0, "removed child");
+
+    changes = b.Diff(a);
+    Check(changes.size() == 1 && changes[0].first == 0 && changes[0].second == a.DocumentElement()->ChildNodes()[0], "added child");
+
+    changes = a.Diff(c);
+    Check(changes.size() == 2, "added and changed children");
+    Check(changes.size() == 2 && changes[0].first == 0 && changes[0].second->LocalName() == "x", "added child in the middle");
+    Check(changes.size() == 2 && changes[1].first->InnerText() == "1" && changes[1].second->InnerText() == "2", "changed text");
+
+    Check(a.Diff(d).empty(), "equal documents");
+}
+
+class Collector : public XmlPathFilter
+{
+public:
+    vector<string> values;
+    vector<string> nodes;
+
+protected:
+    virtual void OnMatch(const string& path, XmlNode* node)
+    {
+        this->nodes.push_back(node->OuterXml());
+    }
+
+    virtual void OnMatch(const string& path, const string& value)
+    {
+        this->values.push_back(value);
+    }
+};
+
+static void CheckFilter()
+{
+    Collector filter;
+    Check(filter.AddPath("//@id"), "lone attribute step");
+    Check(filter.AddPath("//a"), "descendant step");
+    Check(filter.AddPath("") == false && filter.AddPath("/") == false, "path without steps");
+
+    string xml = "<r id=\"1\"><a id=\"2\"><a/></a></r>";
+    Check(filter.Feed(xml.c_str(), xml.size()) && filter.Finish(), "filter input");
+    Check(filter.values.size() == 2 && filter.values[0] == "1" && filter.values[1] == "2", "//@id matches any element");
+    Check(filter.nodes.size() == 2 && filter.nodes[0] == "<a />" && filter.nodes[1] == "<a id=\"2\"><a /></a>", "nested matches");
+}
+
+static void CheckIndex()
+{
+    // Keys with line breaks or tabs survive a save and load of the index
+    {
+        WriteFile("checks.xml", "<r><a k=\"x&#10;y\"/><a k=\"t&#9;\\\"/><a/></r>");
+        XmlRecordIndex index;
+        Check(index.Build("checks.xml", 1, "k") && index.Count() == 3, "index built");
+        Check(index.Save("checks.idx"), "index saved");
+
+        XmlRecordIndex loaded;
+        Check(loaded.Load("checks.idx") && loaded.Count() == 3, "index loaded");
+        Check(loaded.Find("x\ny") != 0 && loaded.Find("t\t\\") != 0, "escaped keys");
+
+        XmlDocument doc;
+        Check(loaded.LoadRecord("checks.xml", "x\ny", doc) && doc.DocumentElement()->OuterXml() == "<a k=\"x\ny\" />", "record by escaped key");
+    }
+
+    // Malformed input stops the build
+    {
+        WriteFile("checks.xml", "<r><a></b></r>");
+        XmlRecordIndex index;
+        Check(index.Build("checks.xml", 1) == false, "malformed index input");
+    }
+}
+
+static void CheckErrors()
+{
+    {
+        XmlDocument doc;
+        XmlParseResult result;
+        Check(doc.TryLoadXml("<r>\n  <a></b>\n</r>", result) == XmlParseWrongClosingTag, "wrong closing tag");
+        Check(result.offset == 9 && result.line == 2 && result.column == 6, "wrong closing tag position");
+        Check(result.expected == "a" && result.found == "b", "wrong closing tag tokens");
+        Check(doc.DocumentElement() == 0, "nothing is loaded on an error");
+
+        Check(doc.TryLoadXml("<r><a>", result) == XmlParseUnexpectedEnd, "truncated input");
+        Check(doc.TryLoadXml("<r/>", result) == XmlParseOk && result.error == XmlParseOk, "result is reset between loads");
+    }
+
+    // A / that does not close the tag used to hang the parser
+    {
+        const char* inputs[] = { "<a/b>", "<a / >", "<a b=\"1\"/c>", "<r></r x/y>", "<?xml a/b?><r/>" };
+        for (size_t i = 0; i < sizeof(inputs) / sizeof(inputs[0]); i++)
+        {
+            XmlDocument doc;
+            XmlParseResult result;
+            Check(doc.TryLoadXml(inputs[i], result) == XmlParseUnexpectedToken, "stray / in a tag");
+
+            XmlPushParser parser(&doc);
+            string xml = inputs[i];
+            bool parsed = parser.Feed(xml.c_str(), xml.size()) && parser.Finish();
+            Check(parsed == false && parser.Result().error == XmlParseUnexpectedToken, "stray / in a tag, pushed");
+        }
+    }
+
+    // A second document element fails without touching the open elements
+    {
+        XmlDocument doc;
+        XmlPushParser parser(&doc);
+        Check(parser.Feed("<a/><b/>", 8) == false, "second self-closing document element");
+        Check(parser.Result().error == XmlParseMultipleDocumentElements && parser.Result().offset == 4, "second document element error");
+    }
+
+    // A failed Load keeps the document that was there, a second Load replaces it
+    {
+        XmlDocument doc;
+        WriteFile("checks.xml", "<?xml version=\"1.0\"?>\n<!DOCTYPE r>\n<r><a/></r>\n");
+        Check(doc.Load("checks.xml") && doc.Load("checks.xml"), "load twice");
+        Check(doc.DocumentElement() != 0 && doc.DocumentElement()->OuterXml() == "<r><a /></r>", "reloaded document");
+
+        size_t nodes = doc._nodes.size();
+        WriteFile("checks.xml", "<r><b>\n");
+        Check(doc.Load("checks.xml") == false, "truncated file");
+        Check(doc.DocumentElement() != 0 && doc.DocumentElement()->OuterXml() == "<r><a /></r>", "failed load keeps the document");
+        Check(doc._nodes.size() == nodes, "failed load frees the partial tree");
+    }
+}
+
+static void CheckClone()
+{
+    XmlDocument doc;
+    XmlParseResult result;
+    Check(doc.TryLoadXml("<?xml version=\"1.0\"?><r><a x=\"1\"><c>text</c></a><b/></r>", result) == XmlParseOk, "clone source");
+    XmlNode* r = doc.DocumentElement();
+    XmlNode* a = r->ChildNodes()[0];
+    XmlNode* b = r->ChildNodes()[1];
+
+    XmlNode* declaration = doc._declaration->CloneNode(true);
+    Check(declaration->OuterXml() == "<?xml version=\"1.0\"?>", "clone declaration");
+    delete declaration;
+
+    XmlNode* deep = a->CloneNode(true);
+    Check(deep->OuterXml() == a->OuterXml() && deep->Hash() == a->Hash(), "deep clone");
+    XmlNode* shallow = a->CloneNode(false);
+    Check(shallow->OuterXml() == "<a x=\"1\" />", "shallow clone");
+    delete shallow;
+
+    Check(b->AppendChild(deep) == deep && r->OuterXml() == "<r><a x=\"1\"><c>text</c></a><b><a x=\"1\"><c>text</c></a></b></r>", "append clone");
+
+    // Appending a node that already has a parent moves it
+    Check(b->AppendChild(a) == a && r->ChildNodes().size() == 1, "append moves the node");
+    Check(r->OuterXml() == "<r><b><a x=\"1\"><c>text</c></a><a x=\"1\"><c>text</c></a></b></r>", "moved node output");
+
+    Check(a->AppendChild(b) == 0 && b->AppendChild(b) == 0, "a node can not go inside itself");
+    Check(b->AppendChild(r) == 0, "document element can not be appended");
+    Check(b->AppendChild(a->Attributes()["x"]) == 0, "attributes can not be appended");
+
+    // Nodes of another document go through ImportNode
+    XmlDocument other;
+    Check(other.TryLoadXml("<o><p/></o>", result) == XmlParseOk, "other document");
+    XmlNode* foreign = other.DocumentElement()->CloneNode(true);
+    Check(r->AppendChild(foreign) == 0, "node of another document is rejected");
+    delete foreign;
+    XmlNode* imported = doc.ImportNode(other.DocumentElement(), true);
+    Check(imported->OwnerDocument() == &doc && r->AppendChild(imported) == imported, "imported node");
+    Check(r->OuterXml() == "<r><b><a x=\"1\"><c>text</c></a><a x=\"1\"><c>text</c></a></b><o><p /></o></r>", "imported node output");
+
+    // Clones are not part of the tree until they are appended
+    XmlDocument source;
+    Check(source.TryLoadXml("<r><i/><i/></r>", result) == XmlParseOk, "clone search source");
+    unsigned long generation = source.Generation();
+    XmlNode* copy = source.DocumentElement()->CloneNode(true);
+    Check(source.Generation() == generation, "cloning does not change the document");
+    Check(source.SelectNodes("//i").size() == 2, "detached clones are not searched");
+    delete copy;
+}
+
+int main(int argc, char* argv[])
+{
+    CheckEncoding();
+    CheckPush();
+    CheckCaches();
+    CheckXPathCache();
+    CheckDiff();
+    CheckFilter();
+    CheckIndex();
+    CheckErrors();
+    CheckClone();
+
+    if (failures == 0)
+        cout << "All checks passed" << endl;
+
+    return (failures == 0 ? 0 : 1);
+}
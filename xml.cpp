@@ -1,5 +1,10 @@
 #include "xml.h"
 #include <fstream>
+#include <cstdlib>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <algorithm>
 
 using namespace std;
 using namespace common::xml;
@@ -8,8 +13,9 @@ using namespace common::xml;
 // XmlNode
 ////////////////////////////////////////////////////////////////////////////////////
 XmlNode::XmlNode(XmlDocument* ownerDocument, XmlNode* parentNode, const string& localname)
-    : _ownerDocument(ownerDocument), _parentNode(parentNode), _localName(localname)
+    : _ownerDocument(ownerDocument), _parentNode(parentNode), _localName(localname), _outerXmlValid(false), _hash(0), _hashValid(false)
 {
+    // A new node is not part of the tree yet, the generation changes once it is attached
     if (this->_ownerDocument != 0)
         this->_ownerDocument->_nodes.insert(this);
 }
@@ -19,7 +25,10 @@ XmlNode::~XmlNode()
     this->ClearAttributes();
     this->ClearChildNodes();
     if (this->_ownerDocument != 0)
+    {
         this->_ownerDocument->_nodes.erase(this);
+        this->_ownerDocument->_generation++;
+    }
 }
 
 string XmlNode::InnerText()
@@ -36,6 +45,7 @@ void XmlNode::InnerText(const string& innertext)
 {
     this->ClearChildNodes();
     this->_childNodes.push_back(new XmlText(this->OwnerDocument(), this, innertext));
+    this->MarkDirty();
 }
 
 string XmlNode::InnerXml()
@@ -48,18 +58,45 @@ string XmlNode::InnerXml()
     return result;
 }
 
+const string* XmlNode::InnerTextData()
+{
+    if (this->_childNodes.size() == 1)
+        return this->_childNodes[0]->InnerTextData();
+    return 0;
+}
+
 void XmlNode::InnerXml(const string& innerxml)
 {
+    // Parsed before anything is cleared, so malformed xml leaves the node and its caches as they were
+    XmlParseResult result;
+    XmlNodeList nodes = XmlNode::LoadXml(this->_ownerDocument, innerxml, result);
+    if (result.error != XmlParseOk)
+    {
+        priv::Locate(result, innerxml.c_str(), size_t(result.offset));
+        priv::ThrowParseError(result);
+        return;
+    }
+
     this->ClearChildNodes();
-    this->_childNodes = XmlNode::LoadXml(this->_ownerDocument, innerxml);
+    this->_childNodes = nodes;
+    for (XmlNodeList::iterator i = this->_childNodes.begin(); i != this->_childNodes.end(); ++i)
+        (*i)->_parentNode = this;
+    this->MarkDirty();
 }
 
 string XmlNode::OuterXml()
 {
+    if (this->_outerXmlValid)
+        return this->_outerXml;
+
     string result = "<" + this->_localName;
 
     for (XmlAttributeCollection::iterator i = this->_attributes.begin(); i != this->_attributes.end(); ++i)
-        result += " " + (*i).first + "=\"" + (*i).second->Value() + "\"";
+    {
+        result += " " + (*i).first + "=\"";
+        priv::AppendEscaped(result, (*i).second->Value(), true);
+        result += "\"";
+    }
     if (this->_childNodes.size() > 0)
     {
         result += ">";
@@ -72,9 +109,104 @@ string XmlNode::OuterXml()
     else
         result += " />";
 
+    if (this->_ownerDocument != 0 && this->_ownerDocument->_cacheOuterXml)
+    {
+        this->_outerXml = result;
+        this->_outerXmlValid = true;
+    }
+
     return result;
 }
 
+void XmlNode::MarkDirty()
+{
+    this->_outerXmlValid = false;
+    this->_outerXml.clear();
+    this->_hashValid = false;
+    if (this->_ownerDocument != 0)
+        this->_ownerDocument->_generation++;
+
+    // A valid cache implies valid caches below it, so we can stop at the first invalid parent
+    XmlNode* node = this->_parentNode;
+    while (node != 0 && (node->_outerXmlValid || node->_hashValid))
+    {
+        node->_outerXmlValid = false;
+        node->_outerXml.clear();
+        node->_hashValid = false;
+        node = node->_parentNode;
+    }
+}
+
+XmlNode* XmlNode::CloneNode(bool deep)
+{
+    return this->_Clone(this->_ownerDocument, 0, deep);
+}
+
+XmlNode* XmlNode::AppendChild(XmlNode* node)
+{
+    if (node == 0 || node->_ownerDocument != this->_ownerDocument || dynamic_cast<XmlAttribute*>(node) != 0)
+        return 0;
+
+    // The top level nodes are owned by the document itself
+    if (this->_ownerDocument != 0 && (node == this->_ownerDocument->_documentElement || node == this->_ownerDocument->_declaration))
+        return 0;
+
+    // A node can not end up inside itself
+    for (XmlNode* parent = this; parent != 0; parent = parent->_parentNode)
+    {
+        if (parent == node)
+            return 0;
+    }
+
+    if (node->_parentNode != 0)
+    {
+        XmlNodeList& siblings = node->_parentNode->_childNodes;
+        XmlNodeList::iterator found = find(siblings.begin(), siblings.end(), node);
+        if (found == siblings.end())
+            return 0;
+
+        siblings.erase(found);
+        node->_parentNode->MarkDirty();
+    }
+
+    node->_parentNode = this;
+    this->_childNodes.push_back(node);
+    this->MarkDirty();
+
+    return node;
+}
+
+XmlNode* XmlNode::_Clone(XmlDocument* ownerDocument, XmlNode* parentNode, bool deep)
+{
+    XmlNode* clone = new XmlNode(ownerDocument, parentNode, this->_localName);
+    this->_CloneContent(clone, deep);
+    return clone;
+}
+
+void XmlNode::_CloneContent(XmlNode* clone, bool deep)
+{
+    // Attributes come out of the map in order, so every insert goes straight to the end
+    for (XmlAttributeCollection::iterator i = this->_attributes.begin(); i != this->_attributes.end(); ++i)
+    {
+        XmlNode* source = (*i).second;
+        XmlAttribute* attribute = static_cast<XmlAttribute*>(source->_Clone(clone->_ownerDocument, clone, deep));
+        clone->_attributes.insert(clone->_attributes.end(), make_pair((*i).first, attribute));
+    }
+
+    if (deep == false)
+        return;
+
+    clone->_childNodes.reserve(this->_childNodes.size());
+    for (XmlNodeList::iterator i = this->_childNodes.begin(); i != this->_childNodes.end(); ++i)
+        clone->_childNodes.push_back((*i)->_Clone(clone->_ownerDocument, clone, true));
+
+    // A deep copy renders and hashes the same, so the cached results stay valid
+    clone->_outerXml = this->_outerXml;
+    clone->_outerXmlValid = this->_outerXmlValid;
+    clone->_hash = this->_hash;
+    clone->_hashValid = this->_hashValid;
+}
+
 void XmlNode::ClearAttributes()
 {
     map<string, XmlAttribute*>::iterator it = this->_attributes.begin();
@@ -106,15 +238,30 @@ XmlDeclaration::XmlDeclaration(XmlDocument *ownerDocument, const vector<string>
     this->_attributes = XmlNode::_LoadAttributes(ownerDocument, this, tokens);
 }
 
+XmlDeclaration::XmlDeclaration(XmlDocument *ownerDocument)
+    : XmlNode(ownerDocument, 0, "<?xml Declaration ?>")
+{ }
+
 XmlDeclaration::~XmlDeclaration()
 { }
 
+XmlNode* XmlDeclaration::_Clone(XmlDocument* ownerDocument, XmlNode* parentNode, bool deep)
+{
+    XmlDeclaration* clone = new XmlDeclaration(ownerDocument);
+    this->_CloneContent(clone, deep);
+    return clone;
+}
+
 string XmlDeclaration::OuterXml()
 {
     string result = "<?xml";
 
     for (XmlAttributeCollection::iterator i = this->_attributes.begin(); i != this->_attributes.end(); i++)
-        result += " " + (*i).first + "=\"" + (*i).second->Value() + "\"";
+    {
+        result += " " + (*i).first + "=\"";
+        priv::AppendEscaped(result, (*i).second->Value(), true);
+        result += "\"";
+    }
 
     result += "?>";
 
@@ -131,9 +278,15 @@ XmlCharacterData::XmlCharacterData(XmlDocument* ownerDocument, XmlNode* parentNo
 XmlCharacterData::~XmlCharacterData()
 { }
 
+XmlNode* XmlCharacterData::_Clone(XmlDocument* ownerDocument, XmlNode* parentNode, bool deep)
+{
+    return new XmlCharacterData(ownerDocument, parentNode, this->_data);
+}
+
 void XmlCharacterData::InnerText(const string& text)
 {
     this->_data = text;
+    this->MarkDirty();
 }
 
 string XmlCharacterData::OuterXml()
@@ -151,9 +304,16 @@ XmlText::XmlText(XmlDocument* ownerDocument, XmlNode* parentNode, const string&
 XmlText::~XmlText()
 { }
 
+XmlNode* XmlText::_Clone(XmlDocument* ownerDocument, XmlNode* parentNode, bool deep)
+{
+    return new XmlText(ownerDocument, parentNode, this->_data);
+}
+
 string XmlText::OuterXml()
 {
-    return this->_data;
+    string result;
+    priv::AppendEscaped(result, this->_data, false);
+    return result;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////
@@ -166,9 +326,15 @@ XmlComment::XmlComment(XmlDocument* ownerDocument, XmlNode* parentNode, const st
 XmlComment::~XmlComment()
 { }
 
+XmlNode* XmlComment::_Clone(XmlDocument* ownerDocument, XmlNode* parentNode, bool deep)
+{
+    return new XmlComment(ownerDocument, parentNode, this->_comment);
+}
+
 void XmlComment::Comment(const string& comment)
 {
     this->_comment = comment;
+    this->MarkDirty();
 }
 
 string XmlComment::OuterXml()
@@ -186,19 +352,31 @@ XmlAttribute::XmlAttribute(XmlDocument* ownerDocument, XmlNode* parentNode, cons
 XmlAttribute::~XmlAttribute()
 { }
 
+XmlNode* XmlAttribute::_Clone(XmlDocument* ownerDocument, XmlNode* parentNode, bool deep)
+{
+    return new XmlAttribute(ownerDocument, parentNode, this->_key, this->_value);
+}
+
 void XmlAttribute::Value(const string& value)
 {
     this->_value = value;
+    this->MarkDirty();
 }
 
 ////////////////////////////////////////////////////////////////////////////////////
 // XmlDocument
 ////////////////////////////////////////////////////////////////////////////////////
 XmlDocument::XmlDocument()
-    : _documentElement(0), _declaration(0)
+    : _documentElement(0), _declaration(0), _validateEncoding(false), _cacheOuterXml(false),
+      _generation(0), _xpathCacheSize(0), _xpathCacheGeneration(0)
 { }
 
 XmlDocument::~XmlDocument()
+{
+    this->ClearNodes();
+}
+
+void XmlDocument::ClearNodes()
 {
     if (this->_declaration != 0)
         delete this->_declaration;
@@ -208,31 +386,109 @@ XmlDocument::~XmlDocument()
     this->_documentElement = 0;
 }
 
+XmlNode* XmlDocument::ImportNode(XmlNode* node, bool deep)
+{
+    return node->_Clone(this, 0, deep);
+}
+
 bool XmlDocument::Load(const string& filename)
 {
-    ifstream ifs(filename.c_str());
+    ifstream ifs(filename.c_str(), ios::in | ios::binary);
+    if (!ifs)
+        return false;
+
+    // The push parser builds into the document, the previous tree is kept aside until the new one is complete
+    XmlNode* declaration = this->_declaration;
+    XmlNode* documentElement = this->_documentElement;
+    this->_declaration = this->_documentElement = 0;
+
+    // Parse while reading, instead of waiting for the whole file
+    XmlPushParser parser(this);
+    parser.ValidateEncoding(this->_validateEncoding);
+    char chunk[64 * 1024];
+    while (ifs.read(chunk, sizeof(chunk)) || ifs.gcount() > 0)
+    {
+        if (parser.Feed(chunk, ifs.gcount()) == false)
+            break;
+    }
+
+    bool loaded = parser.Finish();
+    this->EndLoad(loaded, declaration, documentElement);
+    if (loaded)
+        return true;
 
-    string content((istreambuf_iterator<char>(ifs)), (istreambuf_iterator<char>()));
+    priv::ThrowParseError(parser.Result());
+    return false;
+}
+
+void XmlDocument::EndLoad(bool loaded, XmlNode* declaration, XmlNode* documentElement)
+{
+    this->_generation++;
+
+    // Like TryLoadXml, a failed load leaves the document as it was
+    if (loaded == false)
+    {
+        this->ClearNodes();
+        this->_declaration = declaration;
+        this->_documentElement = documentElement;
+        return;
+    }
 
-    return this->LoadXml(content);
+    if (declaration != 0)
+        delete declaration;
+    if (documentElement != 0)
+        delete documentElement;
 }
 
 bool XmlDocument::LoadXml(const string& xml)
 {
-    XmlNodeList result = XmlNode::LoadXml(this, xml);
+    XmlParseResult result;
+    if (this->TryLoadXml(xml, result) == XmlParseOk)
+        return true;
 
-    if (result.size() > 2)
-        return false;
+    priv::ThrowParseError(result);
+    return false;
+}
 
-    if (result.size() > 1 && result[0]->LocalName() != "<?xml Declaration ?>")
-        return false;
+XmlParseError XmlDocument::TryLoadXml(const string& xml, XmlParseResult& result)
+{
+    result = XmlParseResult();
+
+    if (this->_validateEncoding)
+    {
+        size_t valid = priv::ValidUtf8Length(xml.c_str(), xml.size());
+        if (valid != xml.size())
+            priv::Fail(result, XmlParseInvalidEncoding, valid, "utf-8");
+    }
 
-    if (result.size() == 2)
-        this->_declaration = result[0];
+    XmlNodeList nodes;
+    if (result.error == XmlParseOk)
+        nodes = XmlNode::LoadXml(this, xml, result);
 
-    this->_documentElement = result[result.size()-1];
+    if (result.error == XmlParseOk)
+    {
+        if (nodes.empty())
+            priv::Fail(result, XmlParseNoDocumentElement, xml.size(), "<");
+        else if (nodes.size() > 2 || (nodes.size() == 2 && nodes[0]->LocalName() != "<?xml Declaration ?>"))
+            priv::Fail(result, XmlParseMultipleDocumentElements, xml.size(), "end of document", nodes[nodes.size()-1]->LocalName());
+    }
 
-    return true;
+    if (result.error != XmlParseOk)
+    {
+        for (XmlNodeList::iterator i = nodes.begin(); i != nodes.end(); ++i)
+            delete *i;
+        priv::Locate(result, xml.c_str(), size_t(result.offset));
+        return result.error;
+    }
+
+    this->ClearNodes();
+    this->_generation++;
+    if (nodes.size() == 2)
+        this->_declaration = nodes[0];
+
+    this->_documentElement = nodes[nodes.size()-1];
+
+    return XmlParseOk;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////
@@ -258,9 +514,9 @@ priv::XmlParser& priv::XmlParser::operator = (const XmlParser& other)
     return (*this);
 }
 
-priv::XmlParser& priv::XmlParser::operator += (int count)
+priv::XmlParser& priv::XmlParser::operator += (size_t count)
 {
-    if (((this->_cursor + count) - this->_data) < this->_size)
+    if (size_t((this->_cursor + count) - this->_data) <= this->_size)
         this->_cursor += count;
 
     return (*this);
@@ -281,12 +537,12 @@ bool priv::XmlParser::operator == (char c) const
 
 bool priv::XmlParser::HasToken()
 {
-    return ((this->_cursor - this->_data) < this->_size);
+    return (size_t(this->_cursor - this->_data) < this->_size);
 }
 
 void priv::XmlParser::SkipSpaces()
 {
-    while (this->HasToken() && this->_cursor[0] <= ' ')
+    while (this->HasToken() && (unsigned char)this->_cursor[0] <= ' ')
         this->_cursor++;
 }
 
@@ -294,8 +550,8 @@ string priv::XmlParser::CurrentToken()
 {
     string result;
 
-    int at = (this->_cursor - this->_data);
-    int charsLeft = this->_size - at;
+    size_t at = (this->_cursor - this->_data);
+    size_t charsLeft = this->_size - at;
 
     if (charsLeft >= 2
             && this->_cursor[0] == '<'
@@ -368,15 +624,16 @@ string priv::XmlParser::CurrentToken()
     else if (this->_cursor[0] == '\"')
     {
         result += this->_cursor[0];
-        int i = 1;
-        while (this->_cursor[i] != '\"')
+        size_t i = 1;
+        while (i < charsLeft && this->_cursor[i] != '\"')
             result += this->_cursor[i++];
-        result += this->_cursor[i];
+        if (i < charsLeft)
+            result += this->_cursor[i];
     }
     else
     {
-        int i = 0;
-        while (this->_cursor[i] > ' ' && this->_cursor[i] != '<' && this->_cursor[i] != '=' && this->_cursor[i] != '/' && this->_cursor[i] != '>')
+        size_t i = 0;
+        while ((unsigned char)this->_cursor[i] > ' ' && this->_cursor[i] != '<' && this->_cursor[i] != '=' && this->_cursor[i] != '/' && this->_cursor[i] != '>')
             result += this->_cursor[i++];
     }
 
@@ -396,31 +653,209 @@ char priv::XmlParser::Character()
     return this->_cursor[0];
 }
 
+////////////////////////////////////////////////////////////////////////////////////
+// Parse errors
+////////////////////////////////////////////////////////////////////////////////////
+bool priv::Fail(XmlParseResult& result, XmlParseError error, unsigned long long offset, const string& expected, const string& found)
+{
+    if (result.error != XmlParseOk)
+        return false;
+
+    result.error = error;
+    result.offset = offset;
+    result.expected = expected;
+    result.found = found;
+
+    return false;
+}
+
+void priv::Locate(XmlParseResult& result, const char* data, size_t size, unsigned long line, unsigned long column)
+{
+    // Only done for malformed input, so well-formed input never pays for counting lines
+    for (size_t i = 0; i < size; i++)
+    {
+        if (data[i] == '\n')
+        {
+            line++;
+            column = 1;
+        }
+        else
+            column++;
+    }
+
+    result.line = line;
+    result.column = column;
+}
+
+void priv::ThrowParseError(const XmlParseResult& result)
+{
+#ifdef COMMON_XML_EXCEPTIONS
+    if (result.error == XmlParseWrongClosingTag)
+        throw string("Wrong closing tag found: ") + result.found + string(" instead of ") + result.expected;
+    if (result.error == XmlParseUnexpectedClosingTag)
+        throw string("Closing tag found, were none was needed: " + result.found);
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+// priv::ParseValue
+////////////////////////////////////////////////////////////////////////////////////
+static bool OnlySpaces(const char* end)
+{
+    while (*end != '\0' && (unsigned char)*end <= ' ')
+        end++;
+    return (*end == '\0');
+}
+
+bool priv::ParseValue(const string& text, long long& value)
+{
+    char* end = 0;
+    errno = 0;
+    value = strtoll(text.c_str(), &end, 10);
+    return (end != text.c_str() && errno == 0 && OnlySpaces(end));
+}
+
+bool priv::ParseValue(const string& text, unsigned long long& value)
+{
+    char* end = 0;
+    errno = 0;
+    value = strtoull(text.c_str(), &end, 10);
+    return (end != text.c_str() && errno == 0 && OnlySpaces(end) && text.find('-') == string::npos);
+}
+
+bool priv::ParseValue(const string& text, long& value)
+{
+    long long result;
+    if (priv::ParseValue(text, result) == false || result < LONG_MIN || result > LONG_MAX)
+        return false;
+    value = long(result);
+    return true;
+}
+
+bool priv::ParseValue(const string& text, int& value)
+{
+    long long result;
+    if (priv::ParseValue(text, result) == false || result < INT_MIN || result > INT_MAX)
+        return false;
+    value = int(result);
+    return true;
+}
+
+bool priv::ParseValue(const string& text, unsigned long& value)
+{
+    unsigned long long result;
+    if (priv::ParseValue(text, result) == false || result > ULONG_MAX)
+        return false;
+    value = (unsigned long)result;
+    return true;
+}
+
+bool priv::ParseValue(const string& text, unsigned int& value)
+{
+    unsigned long long result;
+    if (priv::ParseValue(text, result) == false || result > UINT_MAX)
+        return false;
+    value = (unsigned int)result;
+    return true;
+}
+
+bool priv::ParseValue(const string& text, double& value)
+{
+    char* end = 0;
+    errno = 0;
+    value = strtod(text.c_str(), &end);
+    return (end != text.c_str() && errno == 0 && OnlySpaces(end));
+}
+
+bool priv::ParseValue(const string& text, float& value)
+{
+    char* end = 0;
+    errno = 0;
+    value = strtof(text.c_str(), &end);
+    return (end != text.c_str() && errno == 0 && OnlySpaces(end));
+}
+
+bool priv::ParseValue(const string& text, bool& value)
+{
+    const char* begin = text.c_str();
+    while (*begin != '\0' && (unsigned char)*begin <= ' ')
+        begin++;
+
+    if (strncmp(begin, "true", 4) == 0 && OnlySpaces(begin + 4))
+        value = true;
+    else if (strncmp(begin, "false", 5) == 0 && OnlySpaces(begin + 5))
+        value = false;
+    else if ((*begin == '1' || *begin == '0') && OnlySpaces(begin + 1))
+        value = (*begin == '1');
+    else
+        return false;
+
+    return true;
+}
+
+bool priv::ParseValue(const string& text, string& value)
+{
+    value = text;
+    return true;
+}
+
 ////////////////////////////////////////////////////////////////////////////////////
 // Xml Loading code
 ////////////////////////////////////////////////////////////////////////////////////
 XmlNodeList XmlNode::LoadXml(XmlDocument* ownerDocument, const string& xml)
 {
-    XmlNodeList result;
+    XmlParseResult result;
+    XmlNodeList nodes = XmlNode::LoadXml(ownerDocument, xml, result);
+
+    if (result.error != XmlParseOk)
+    {
+        priv::Locate(result, xml.c_str(), size_t(result.offset));
+        priv::ThrowParseError(result);
+    }
+
+    return nodes;
+}
+
+XmlNodeList XmlNode::LoadXml(XmlDocument* ownerDocument, const string& xml, XmlParseResult& result)
+{
+    XmlNodeList nodes;
     priv::XmlParser parser(xml);
 
+    // A utf-8 byte order mark is allowed before anything else
+    if (xml.compare(0, 3, "\xEF\xBB\xBF") == 0)
+        parser += 3;
     parser.SkipSpaces();
 
     while (parser.HasToken() && parser.Character() == '<')
     {
-        XmlNode* node = XmlNode::_LoadNode(ownerDocument, 0, parser);
+        XmlNode* node = XmlNode::_LoadNode(ownerDocument, 0, parser, result);
+        if (result.error != XmlParseOk)
+        {
+            for (XmlNodeList::iterator i = nodes.begin(); i != nodes.end(); ++i)
+                delete *i;
+            return XmlNodeList();
+        }
         if (node != 0)
-            result.push_back(node);
+            nodes.push_back(node);
         parser.SkipSpaces();
     }
 
-    return result;
+    return nodes;
 }
 
-XmlNode* XmlNode::_LoadNode(XmlDocument* ownerDocument, XmlNode* parentNode, priv::XmlParser& parser)
+static XmlNode* Fail(XmlParseResult& result, XmlParseError error, const priv::XmlParser& parser, const string& expected, const string& found = "")
+{
+    priv::Fail(result, error, parser._cursor - parser._data, expected, found);
+    return 0;
+}
+
+XmlNode* XmlNode::_LoadNode(XmlDocument* ownerDocument, XmlNode* parentNode, priv::XmlParser& parser, XmlParseResult& result)
 {
     parser.SkipSpaces();
 
+    if (parser.HasToken() == false)
+        return Fail(result, XmlParseUnexpectedEnd, parser, parentNode != 0 ? "</" + parentNode->LocalName() + ">" : "<");
+
     // <?xml ?>
     if (parser.CurrentToken() == "<?xml")
     {
@@ -428,6 +863,10 @@ XmlNode* XmlNode::_LoadNode(XmlDocument* ownerDocument, XmlNode* parentNode, pri
         string token = parser.NextToken();    // skip <?xml
         while (token != "?>")
         {
+            if (parser.HasToken() == false)
+                return Fail(result, XmlParseUnexpectedEnd, parser, "?>");
+            if (token.empty())
+                return Fail(result, XmlParseUnexpectedToken, parser, "?>", string(1, parser.Character()));
             tokens.push_back(token);
             token = parser.NextToken();
         }
@@ -443,6 +882,8 @@ XmlNode* XmlNode::_LoadNode(XmlDocument* ownerDocument, XmlNode* parentNode, pri
         string data;
         while (parser.CurrentToken() != "]]>")
         {
+            if (parser.HasToken() == false)
+                return Fail(result, XmlParseUnexpectedEnd, parser, "]]>");
             data += parser.Character();
             ++parser;
         }
@@ -458,6 +899,8 @@ XmlNode* XmlNode::_LoadNode(XmlDocument* ownerDocument, XmlNode* parentNode, pri
         string data;
         while (parser.CurrentToken() != "-->")
         {
+            if (parser.HasToken() == false)
+                return Fail(result, XmlParseUnexpectedEnd, parser, "-->");
             data += parser.Character();
             ++parser;
         }
@@ -468,21 +911,25 @@ XmlNode* XmlNode::_LoadNode(XmlDocument* ownerDocument, XmlNode* parentNode, pri
     // </...
     else if (parser.CurrentToken() == "</")
     {
+        priv::XmlParser tag(parser);
         parser.NextToken();    // skip </
-        if (parentNode != 0)
+        if (parentNode == 0)
+            return Fail(result, XmlParseUnexpectedClosingTag, tag, "<", parser.CurrentToken());
+        if (parser.CurrentToken() != parentNode->LocalName())
+            return Fail(result, XmlParseWrongClosingTag, tag, parentNode->LocalName(), parser.CurrentToken());
+
+        string token = parser.CurrentToken();
+        while (token != ">")
         {
-            if (parser.CurrentToken() != parentNode->LocalName())
-                throw string("Wrong closing tag found: ") + parser.CurrentToken() + string(" instead of ") + parentNode->LocalName();
-            else
-            {
-                while (parser.CurrentToken() != ">")
-                    parser.NextToken();
-                parser.NextToken(); // skip >
-                return 0;
-            }
+            if (parser.HasToken() == false)
+                return Fail(result, XmlParseUnexpectedEnd, parser, ">");
+            // A / that is not part of /> is no token at all, and would never be skipped
+            if (token.empty())
+                return Fail(result, XmlParseUnexpectedToken, parser, ">", string(1, parser.Character()));
+            token = parser.NextToken();
         }
-        else
-            throw string("Closing tag found, were none was needed: " + parser.CurrentToken());
+        parser.NextToken(); // skip >
+        return 0;
     }
     // <...> & <.../>
     else if (parser.CurrentToken() == "<")
@@ -492,53 +939,61 @@ XmlNode* XmlNode::_LoadNode(XmlDocument* ownerDocument, XmlNode* parentNode, pri
         string token = parser.NextToken();   // skip <
         while (token != ">" && token != "/>")
         {
+            if (parser.HasToken() == false)
+                return Fail(result, XmlParseUnexpectedEnd, parser, ">");
+            if (token.empty())
+                return Fail(result, XmlParseUnexpectedToken, parser, ">", string(1, parser.Character()));
             tokens.push_back(token);
             token = parser.NextToken();
         }
-        parser.NextToken();   // skip >
 
         // Are there any tokens found before the tag was closed?
-        if (tokens.size() >= 1)
+        if (tokens.size() < 1)
+            return Fail(result, XmlParseUnexpectedToken, parser, "element name", token);
+
+        parser.NextToken();   // skip >
+
+        XmlNode* node = new XmlNode(ownerDocument, parentNode, tokens[0]);
+        if (token == ">")
         {
-            XmlNode* node = new XmlNode(ownerDocument, parentNode, tokens[0]);
-            if (token == ">")
+            XmlNode* child = XmlNode::_LoadNode(ownerDocument, node, parser, result);
+            while (child != 0)
+            {
+                node->_childNodes.push_back(child);
+                child = XmlNode::_LoadNode(ownerDocument, node, parser, result);
+            }
+            if (result.error != XmlParseOk)
             {
-                XmlNode* child = XmlNode::_LoadNode(ownerDocument, node, parser);
-                while (child != 0)
-                {
-                    node->_childNodes.push_back(child);
-                    child = XmlNode::_LoadNode(ownerDocument, node, parser);
-                }
+                delete node;
+                return 0;
             }
-            node->_attributes = XmlNode::_LoadAttributes(ownerDocument, node, tokens);
-            return node;
         }
+        node->_attributes = XmlNode::_LoadAttributes(ownerDocument, node, tokens);
+        return node;
     }
     // regular text
     else
     {
         string data;
-        while (parser.Character() != '<')
+        while (parser.HasToken() && parser.Character() != '<')
         {
             data += parser.Character();
             ++parser;
         }
+        priv::DecodeEntities(data);
         return new XmlText(ownerDocument, parentNode, data);
     }
-    return 0;
 }
 
 XmlAttributeCollection XmlNode::_LoadAttributes(XmlDocument* ownerDocument, XmlNode* parentNode, const std::vector<std::string>& tokens)
 {
     XmlAttributeCollection result;
 
-    for (unsigned int i = 1; i < tokens.size() - 1; i++)
+    for (unsigned int i = 1; i + 1 < tokens.size(); i++)
     {
         if (tokens[i] == "=")
         {
-            string value = tokens[i+1];
-            if (value[0] == '\"' && value[value.size()-1] == '\"')
-                value = value.substr(1, value.size()-2);
+            string value = priv::AttributeValue(tokens[i+1]);
             result.insert(make_pair(tokens[i-1], new XmlAttribute(ownerDocument, parentNode, tokens[i-1], value)));
         }
     }
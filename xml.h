@@ -4,14 +4,44 @@
 #include <vector>
 #include <map>
 #include <set>
+#include <deque>
 #include <string>
 
+#if defined(__cpp_exceptions) || defined(__EXCEPTIONS) || defined(_CPPUNWIND)
+#define COMMON_XML_EXCEPTIONS
+#endif
+
 namespace common
 {
 
 namespace xml
 {
 
+enum XmlParseError
+{
+    XmlParseOk = 0,
+    XmlParseUnexpectedEnd,
+    XmlParseUnexpectedToken,
+    XmlParseWrongClosingTag,
+    XmlParseUnexpectedClosingTag,
+    XmlParseMisplacedDeclaration,
+    XmlParseMultipleDocumentElements,
+    XmlParseNoDocumentElement,
+    XmlParseInvalidEncoding
+};
+
+struct XmlParseResult
+{
+    XmlParseResult() : error(XmlParseOk), offset(0), line(0), column(0) { }
+
+    XmlParseError error;
+    unsigned long long offset;
+    unsigned long line;
+    unsigned long column;
+    std::string expected;
+    std::string found;
+};
+
 namespace priv
 {
 
@@ -23,7 +53,7 @@ public:
     virtual ~XmlParser();
 
     XmlParser& operator = (const XmlParser& other);
-    XmlParser& operator += (int count);
+    XmlParser& operator += (size_t count);
     char operator ++ ();
     bool operator == (char c) const;
 
@@ -35,9 +65,41 @@ public:
 
     const char* _data;
     const char* _cursor;
-    int _size;
+    size_t _size;
 };
 
+// Sets the first error only, line and column are filled in by the caller
+bool Fail(XmlParseResult& result, XmlParseError error, unsigned long long offset, const std::string& expected, const std::string& found = "");
+void Locate(XmlParseResult& result, const char* data, size_t size, unsigned long line = 1, unsigned long column = 1);
+
+// Throws the errors that LoadXml has always thrown, when exceptions are available
+void ThrowParseError(const XmlParseResult& result);
+
+// Replaces entity and character references in place, values without & are left untouched
+void DecodeEntities(std::string& value);
+void AppendEscaped(std::string& result, const std::string& value, bool attribute);
+
+// The value of an attribute token without its quotes and with references decoded
+std::string AttributeValue(const std::string& token);
+// Looks up key in the tokens of a start tag, the way LoadXml reads its attributes
+bool FindAttribute(const std::vector<std::string>& tokens, const std::string& key, std::string& value);
+
+// Length of the leading part of data that is complete and valid utf-8, truncated is set
+// when the rest is only the start of a sequence that more data could still complete
+size_t ValidUtf8Length(const char* data, size_t size, bool* truncated = 0);
+
+// Converts the whole text, surrounding whitespace allowed, returns false when it does not fit
+bool ParseValue(const std::string& text, int& value);
+bool ParseValue(const std::string& text, long& value);
+bool ParseValue(const std::string& text, long long& value);
+bool ParseValue(const std::string& text, unsigned int& value);
+bool ParseValue(const std::string& text, unsigned long& value);
+bool ParseValue(const std::string& text, unsigned long long& value);
+bool ParseValue(const std::string& text, float& value);
+bool ParseValue(const std::string& text, double& value);
+bool ParseValue(const std::string& text, bool& value);
+bool ParseValue(const std::string& text, std::string& value);
+
 }
 
 class XmlNode;
@@ -48,6 +110,17 @@ typedef std::map<std::string, XmlAttribute*> XmlAttributeCollection;
 
 class XmlDocument;
 
+typedef unsigned long long XmlHash;
+typedef std::vector<std::pair<XmlNode*, XmlNode*> > XmlNodeChangeList;
+typedef std::pair<std::pair<XmlNode*, bool>, std::string> XmlXPathCacheKey;
+
+template<typename E>
+struct XmlEnumValue
+{
+    const char* name;
+    E value;
+};
+
 class XmlNode
 {
 public:
@@ -55,6 +128,7 @@ public:
     virtual ~XmlNode();
 
     static XmlNodeList LoadXml(XmlDocument* ownerDocument, const std::string& xml);
+    static XmlNodeList LoadXml(XmlDocument* ownerDocument, const std::string& xml, XmlParseResult& result);
 
     virtual std::string InnerText();
     virtual void InnerText(const std::string& innertext);
@@ -65,25 +139,59 @@ public:
     XmlNodeList SelectNodes(const std::string& xpath);
     XmlNode* SelectSingleNode(const std::string& xpath);
 
+    // The stored text when this node holds a single text or CDATA node, 0 otherwise
+    virtual const std::string* InnerTextData();
+
+    template<typename T> T AttributeAs(const std::string& name, T defaultValue = T());
+    template<typename E, size_t N> E AttributeAs(const std::string& name, const XmlEnumValue<E> (&values)[N], E defaultValue);
+    template<typename T> T TextAs(T defaultValue = T());
+    template<typename E, size_t N> E TextAs(const XmlEnumValue<E> (&values)[N], E defaultValue);
+
     const std::string& LocalName() { return this->_localName; }
     XmlDocument* OwnerDocument() { return this->_ownerDocument; }
 
     XmlAttributeCollection& Attributes() { return this->_attributes; }
     XmlNodeList& ChildNodes() { return this->_childNodes; }
 
+    // Call after changing ChildNodes() or Attributes() directly
+    void MarkDirty();
+
+    // The clone has no parent until it is appended somewhere
+    XmlNode* CloneNode(bool deep);
+
+    // Moves the node itself under this one, nodes of another document need ImportNode first.
+    // Returns 0 when the node can not go here.
+    XmlNode* AppendChild(XmlNode* node);
+
+    XmlHash Hash();
+
+    // Pairs of changed nodes, (node, 0) for a child that is gone and (0, node) for one that was added
+    XmlNodeChangeList Diff(XmlNode* other);
+
 protected:
     XmlDocument* _ownerDocument;
     XmlNode* _parentNode;
     std::string _localName;
     XmlAttributeCollection _attributes;
     XmlNodeList _childNodes;
+    std::string _outerXml;
+    bool _outerXmlValid;
+    XmlHash _hash;
+    bool _hashValid;
+
+    virtual XmlHash ComputeHash();
+    virtual XmlNode* _Clone(XmlDocument* ownerDocument, XmlNode* parentNode, bool deep);
+    void _CloneContent(XmlNode* clone, bool deep);
 
 private:
     void ClearAttributes();
     void ClearChildNodes();
 
 protected:
-    static XmlNode* _LoadNode(XmlDocument* ownerDocument, XmlNode* parentNode, priv::XmlParser& parser);
+    friend class XmlDocument;
+    friend class XmlPushParser;
+
+    static XmlNode* _LoadNode(XmlDocument* ownerDocument, XmlNode* parentNode, priv::XmlParser& parser, XmlParseResult& result);
     static XmlAttributeCollection _LoadAttributes(XmlDocument* ownerDocument, XmlNode* parentNode, const std::vector<std::string>& tokens);
 };
 
@@ -94,6 +202,11 @@ public:
     virtual ~XmlDeclaration();
 
     virtual std::string OuterXml();
+
+protected:
+    XmlDeclaration(XmlDocument* ownerDocument);
+
+    virtual XmlNode* _Clone(XmlDocument* ownerDocument, XmlNode* parentNode, bool deep);
 };
 
 class XmlCharacterData : public XmlNode
@@ -104,10 +217,14 @@ public:
 
     virtual std::string InnerText() { return this->_data; }
     virtual void InnerText(const std::string& data);
+    virtual const std::string* InnerTextData() { return &this->_data; }
 
     virtual std::string OuterXml();
 
 protected:
+    virtual XmlHash ComputeHash();
+    virtual XmlNode* _Clone(XmlDocument* ownerDocument, XmlNode* parentNode, bool deep);
+
     std::string _data;
 
 };
@@ -119,6 +236,10 @@ public:
     virtual ~XmlText();
 
     virtual std::string OuterXml();
+
+protected:
+    virtual XmlHash ComputeHash();
+    virtual XmlNode* _Clone(XmlDocument* ownerDocument, XmlNode* parentNode, bool deep);
 };
 
 class XmlComment : public XmlNode
@@ -132,6 +253,10 @@ public:
 
     virtual std::string OuterXml();
 
+protected:
+    virtual XmlHash ComputeHash();
+    virtual XmlNode* _Clone(XmlDocument* ownerDocument, XmlNode* parentNode, bool deep);
+
 private:
     std::string _comment;
 };
@@ -147,6 +272,10 @@ public:
     virtual const std::string& Value() const { return this->_value; }
     virtual void Value(const std::string& value);
 
+protected:
+    virtual XmlHash ComputeHash();
+    virtual XmlNode* _Clone(XmlDocument* ownerDocument, XmlNode* parentNode, bool deep);
+
 private:
     std::string _key;
     std::string _value;
@@ -160,19 +289,223 @@ public:
 
     bool Load(const std::string& filename);
     bool LoadXml(const std::string& xml);
+    XmlParseError TryLoadXml(const std::string& xml, XmlParseResult& result);
+    bool LoadCompressed(const std::string& filename);
 
     XmlNode* DocumentElement() { return this->_documentElement; }
 
+    bool ValidateEncoding() const { return this->_validateEncoding; }
+    void ValidateEncoding(bool validate) { this->_validateEncoding = validate; }
+
+    bool CacheOuterXml() const { return this->_cacheOuterXml; }
+    void CacheOuterXml(bool cache) { this->_cacheOuterXml = cache; }
+
+    // Bumped on every change to the document
+    unsigned long Generation() const { return this->_generation; }
+
+    // Maximum number of cached SelectNodes/SelectSingleNode results, 0 disables the cache
+    size_t XPathCacheSize() const { return this->_xpathCacheSize; }
+    void XPathCacheSize(size_t size);
+
     XmlNodeList SelectNodes(const std::string& xpath);
     XmlNode* SelectSingleNode(const std::string& xpath);
 
+    XmlNodeChangeList Diff(XmlDocument& other);
+
+    // Copies a node of any document into this one, append the result to place it
+    XmlNode* ImportNode(XmlNode* node, bool deep);
+
 public:
     XmlNode* _declaration;
     XmlNode* _documentElement;
     std::set<XmlNode*> _nodes;
+    bool _validateEncoding;
+    bool _cacheOuterXml;
+    unsigned long _generation;
+    size_t _xpathCacheSize;
+    unsigned long _xpathCacheGeneration;
+    std::map<XmlXPathCacheKey, XmlNodeList> _xpathCache;
+    std::deque<XmlXPathCacheKey> _xpathCacheOrder;
+
+private:
+    void ClearNodes();
+    void EndLoad(bool loaded, XmlNode* declaration, XmlNode* documentElement);
+
+};
+
+class XmlPushParser
+{
+public:
+    XmlPushParser(XmlDocument* document = 0);
+    virtual ~XmlPushParser();
+
+    // Both return false once the input turned out to be malformed, see Result()
+    bool Feed(const char* data, size_t size);
+    bool Finish();
+
+    // Consumed input is not kept, so only the offset is set, line and column stay 0
+    const XmlParseResult& Result() const { return this->_result; }
+
+    void ValidateEncoding(bool validate) { this->_validateEncoding = validate; }
+
+protected:
+    virtual void OnDeclaration(const std::vector<std::string>& tokens);
+    virtual void OnStartElement(const std::vector<std::string>& tokens);
+    virtual void OnEndElement(const std::string& localname);
+    virtual void OnText(const std::string& text);
+    virtual void OnCharacterData(const std::string& data);
+    virtual void OnComment(const std::string& comment);
+
+    // Byte offsets in the whole input of the construct being reported
+    unsigned long long TokenOffset() const { return this->_offset + this->_tokenStart; }
+    unsigned long long TokenEnd() const { return this->_offset + this->_tokenEnd; }
+
+    // Stops parsing, the error is reported at the start of the current construct
+    void Fail(XmlParseError error, const std::string& expected, const std::string& found = "");
+
+    XmlDocument* _document;
+    XmlNodeList _openNodes;
+
+private:
+    void Parse();
+    void ParseTag(size_t end);
+    int StartsWith(size_t at, const char* literal) const;
+
+    std::string _buffer;
+    unsigned long long _offset;
+    size_t _position;
+    size_t _resume;
+    size_t _tokenStart;
+    size_t _tokenEnd;
+    char _tagQuote;
+    int _tagSubset;
+    bool _validateEncoding;
+    size_t _validated;
+    XmlParseResult _result;
+    std::vector<std::string> _openElements;
+
+};
+
+class XmlPathFilter : public XmlPushParser
+{
+public:
+    XmlPathFilter();
+    virtual ~XmlPathFilter();
+
+    // Supports child (/a/b) and descendant (//a) steps, * and a trailing /@attribute,
+    // a lone attribute step (//@id) means any element. Returns false for a path without steps.
+    bool AddPath(const std::string& path);
+
+protected:
+    // The matched element with everything inside it, only valid during the call. A match
+    // nested in another match is still part of the outer subtree and has the outer element as parent.
+    virtual void OnMatch(const std::string& path, XmlNode* node);
+    virtual void OnMatch(const std::string& path, const std::string& value);
+
+    virtual void OnStartElement(const std::vector<std::string>& tokens);
+    virtual void OnEndElement(const std::string& localname);
+
+private:
+    struct Path
+    {
+        std::string expression;
+        std::vector<std::pair<bool, std::string> > steps;
+        std::string attribute;
+    };
+
+    std::vector<Path> _paths;
+    std::vector<std::string> _names;
+    std::vector<std::vector<size_t> > _captures;
 
 };
 
+struct XmlIndexEntry
+{
+    unsigned long long offset;
+    unsigned long long length;
+    std::string key;
+};
+
+class XmlRecordIndex
+{
+public:
+    XmlRecordIndex();
+    virtual ~XmlRecordIndex();
+
+    // Indexes every element at the given depth, the children of the document element are at depth 1
+    bool Build(const std::string& filename, int depth, const std::string& keyAttribute = "");
+    bool Save(const std::string& filename) const;
+    bool Load(const std::string& filename);
+
+    size_t Count() const { return this->_entries.size(); }
+    const XmlIndexEntry& Entry(size_t index) const { return this->_entries[index]; }
+    const XmlIndexEntry* Find(const std::string& key) const;
+
+    bool LoadRecord(const std::string& filename, size_t index, XmlDocument& document) const;
+    bool LoadRecord(const std::string& filename, const std::string& key, XmlDocument& document) const;
+
+private:
+    bool LoadRecord(const std::string& filename, const XmlIndexEntry& entry, XmlDocument& document) const;
+
+    std::vector<XmlIndexEntry> _entries;
+    std::map<std::string, size_t> _keys;
+
+};
+
+namespace priv
+{
+
+template<typename E, size_t N>
+E LookupEnum(const std::string& text, const XmlEnumValue<E> (&values)[N], E defaultValue)
+{
+    for (size_t i = 0; i < N; i++)
+        if (text == values[i].name)
+            return values[i].value;
+    return defaultValue;
+}
+
+}
+
+template<typename T>
+T XmlNode::AttributeAs(const std::string& name, T defaultValue)
+{
+    XmlAttributeCollection::iterator found = this->_attributes.find(name);
+    T value;
+    if (found == this->_attributes.end() || priv::ParseValue(found->second->Value(), value) == false)
+        return defaultValue;
+    return value;
+}
+
+template<typename E, size_t N>
+E XmlNode::AttributeAs(const std::string& name, const XmlEnumValue<E> (&values)[N], E defaultValue)
+{
+    XmlAttributeCollection::iterator found = this->_attributes.find(name);
+    if (found == this->_attributes.end())
+        return defaultValue;
+    return priv::LookupEnum(found->second->Value(), values, defaultValue);
+}
+
+template<typename T>
+T XmlNode::TextAs(T defaultValue)
+{
+    T value;
+    const std::string* data = this->InnerTextData();
+    if (data != 0)
+        return (priv::ParseValue(*data, value) ? value : defaultValue);
+
+    // Mixed content has to be put together first
+    return (priv::ParseValue(this->InnerText(), value) ? value : defaultValue);
+}
+
+template<typename E, size_t N>
+E XmlNode::TextAs(const XmlEnumValue<E> (&values)[N], E defaultValue)
+{
+    const std::string* data = this->InnerTextData();
+    if (data != 0)
+        return priv::LookupEnum(*data, values, defaultValue);
+    return priv::LookupEnum(this->InnerText(), values, defaultValue);
+}
+
 }   // common
 
 }   // xml
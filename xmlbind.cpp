@@ -0,0 +1,494 @@
+// xmlbind: generates C++ structs and a parser that fills them straight from
+// priv::XmlParser tokens, without building an XmlNode tree.
+//
+// Usage: xmlbind <schema.xml> <output.h>
+//
+// Schema:
+//   <schema namespace="messages">
+//     <struct name="Order" element="order">
+//       <attribute name="id" type="int" />
+//       <element name="total" type="double" />
+//       <element name="item" field="items" type="Item" list="true" />
+//       <text field="note" type="string" />
+//     </struct>
+//   </schema>
+//
+// Types are int, long, unsigned, double, float, bool, string or the name of
+// another struct in the schema. The field name defaults to the xml name.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include "xml.h"
+
+using namespace std;
+using namespace common::xml;
+
+struct Field
+{
+    string kind;
+    string name;
+    string field;
+    string type;
+    bool list;
+};
+
+struct Struct
+{
+    string name;
+    string element;
+    vector<Field> fields;
+};
+
+static string Attribute(XmlNode* node, const string& key, const string& defaultValue = "")
+{
+    XmlAttributeCollection::iterator found = node->Attributes().find(key);
+    if (found == node->Attributes().end())
+        return defaultValue;
+    return found->second->Value();
+}
+
+static bool IsPrimitive(const string& type)
+{
+    return (type == "int" || type == "long" || type == "unsigned" || type == "double"
+            || type == "float" || type == "bool" || type == "string");
+}
+
+static string CppType(const Field& field)
+{
+    string type = (field.type == "string" ? "std::string" : field.type);
+    if (field.list)
+        return "std::vector<" + type + " >";
+    return type;
+}
+
+static string DefaultValue(const string& type)
+{
+    if (type == "bool") return "false";
+    if (type == "double" || type == "float" || type == "int" || type == "long" || type == "unsigned") return "0";
+    return "";
+}
+
+// Structs are written in dependency order, a struct is complete before it is used as a field
+static void Order(const string& name, map<string, Struct>& structs, set<string>& done, vector<string>& order)
+{
+    if (done.insert(name).second == false)
+        return;
+
+    Struct& s = structs[name];
+    for (size_t i = 0; i < s.fields.size(); i++)
+        if (structs.find(s.fields[i].type) != structs.end())
+            Order(s.fields[i].type, structs, done, order);
+
+    order.push_back(name);
+}
+
+static const char* Runtime =
+    "namespace xmlbind\n"
+    "{\n"
+    "\n"
+    "typedef common::xml::priv::XmlParser Parser;\n"
+    "\n"
+    "inline bool ReadValue(const char* begin, const char* end, std::string& value)\n"
+    "{\n"
+    "    value.assign(begin, end);\n"
+    "    common::xml::priv::DecodeEntities(value);\n"
+    "    return true;\n"
+    "}\n"
+    "\n"
+    "// A number has to cover the whole value, surrounding whitespace allowed\n"
+    "inline bool ReadAll(const char* begin, const char* parsed, const char* end)\n"
+    "{\n"
+    "    if (parsed == begin || errno != 0)\n"
+    "        return false;\n"
+    "    while (parsed < end && (unsigned char)*parsed <= ' ') parsed++;\n"
+    "    return (parsed == end);\n"
+    "}\n"
+    "\n"
+    "inline bool ReadValue(const char* begin, const char* end, long& value)\n"
+    "{\n"
+    "    char* parsed = 0;\n"
+    "    errno = 0;\n"
+    "    value = strtol(begin, &parsed, 10);\n"
+    "    return ReadAll(begin, parsed, end);\n"
+    "}\n"
+    "inline bool ReadValue(const char* begin, const char* end, int& value)\n"
+    "{\n"
+    "    long result = 0;\n"
+    "    if (ReadValue(begin, end, result) == false || result < INT_MIN || result > INT_MAX)\n"
+    "        return false;\n"
+    "    value = (int)result;\n"
+    "    return true;\n"
+    "}\n"
+    "inline bool ReadValue(const char* begin, const char* end, unsigned& value)\n"
+    "{\n"
+    "    char* parsed = 0;\n"
+    "    errno = 0;\n"
+    "    unsigned long result = strtoul(begin, &parsed, 10);\n"
+    "    if (ReadAll(begin, parsed, end) == false || result > UINT_MAX || std::find(begin, end, '-') != end)\n"
+    "        return false;\n"
+    "    value = (unsigned)result;\n"
+    "    return true;\n"
+    "}\n"
+    "inline bool ReadValue(const char* begin, const char* end, double& value)\n"
+    "{\n"
+    "    char* parsed = 0;\n"
+    "    errno = 0;\n"
+    "    value = strtod(begin, &parsed);\n"
+    "    return ReadAll(begin, parsed, end);\n"
+    "}\n"
+    "inline bool ReadValue(const char* begin, const char* end, float& value)\n"
+    "{\n"
+    "    char* parsed = 0;\n"
+    "    errno = 0;\n"
+    "    value = strtof(begin, &parsed);\n"
+    "    return ReadAll(begin, parsed, end);\n"
+    "}\n"
+    "inline bool ReadValue(const char* begin, const char* end, bool& value)\n"
+    "{\n"
+    "    while (begin < end && (unsigned char)*begin <= ' ') begin++;\n"
+    "    while (end > begin && (unsigned char)*(end - 1) <= ' ') end--;\n"
+    "    size_t length = end - begin;\n"
+    "    if ((length == 4 && strncmp(begin, \"true\", 4) == 0) || (length == 1 && *begin == '1')) value = true;\n"
+    "    else if ((length == 5 && strncmp(begin, \"false\", 5) == 0) || (length == 1 && *begin == '0')) value = false;\n"
+    "    else return false;\n"
+    "    return true;\n"
+    "}\n"
+    "\n"
+    "// The cursor is on the opening quote of the value\n"
+    "template<typename T> inline bool ReadAttribute(Parser& parser, T& value)\n"
+    "{\n"
+    "    const char* begin = parser._cursor + 1;\n"
+    "    const char* end = begin;\n"
+    "    while (end < parser._data + parser._size && *end != '\\\"') end++;\n"
+    "    return ReadValue(begin, end, value);\n"
+    "}\n"
+    "\n"
+    "// The cursor is on text content, it is read up to the next tag\n"
+    "template<typename T> inline bool ReadText(Parser& parser, T& value)\n"
+    "{\n"
+    "    const char* begin = parser._cursor;\n"
+    "    while (parser.HasToken() && parser.Character() != '<') ++parser;\n"
+    "    return ReadValue(begin, parser._cursor, value);\n"
+    "}\n"
+    "\n"
+    "inline bool SkipUntil(Parser& parser, const char* terminator)\n"
+    "{\n"
+    "    size_t length = strlen(terminator);\n"
+    "    while (parser.HasToken() && strncmp(parser._cursor, terminator, length) != 0) ++parser;\n"
+    "    if (parser.HasToken() == false) return false;\n"
+    "    parser += length;\n"
+    "    return true;\n"
+    "}\n"
+    "\n"
+    "// Reads the tokens of a start tag, returns > or />, anything else is malformed\n"
+    "inline std::string StartTag(Parser& parser)\n"
+    "{\n"
+    "    std::string token = parser.NextToken();\n"
+    "    while (token != \">\" && token != \"/>\" && token.empty() == false && parser.HasToken())\n"
+    "        token = parser.NextToken();\n"
+    "    return token;\n"
+    "}\n"
+    "\n"
+    "inline bool EndTag(Parser& parser)\n"
+    "{\n"
+    "    return SkipUntil(parser, \">\");\n"
+    "}\n"
+    "\n"
+    "// Comments and CDATA sections between child elements are skipped, returns false at the end of the data\n"
+    "inline bool SkipMisc(Parser& parser, std::string& token)\n"
+    "{\n"
+    "    parser.SkipSpaces();\n"
+    "    while (parser.HasToken())\n"
+    "    {\n"
+    "        token = parser.CurrentToken();\n"
+    "        if (token == \"<!--\") { if (SkipUntil(parser, \"-->\") == false) return false; }\n"
+    "        else if (token == \"<![CDATA[\") { if (SkipUntil(parser, \"]]>\") == false) return false; }\n"
+    "        else if (token == \"<?xml\") { if (SkipUntil(parser, \"?>\") == false) return false; }\n"
+    "        else return true;\n"
+    "        parser.SkipSpaces();\n"
+    "    }\n"
+    "    return false;\n"
+    "}\n"
+    "\n"
+    "inline bool SkipElement(Parser& parser)\n"
+    "{\n"
+    "    std::string tag = StartTag(parser);\n"
+    "    if (tag == \"/>\")\n"
+    "        return (parser += 2, true);\n"
+    "    if (tag != \">\")\n"
+    "        return false;\n"
+    "    parser += 1;\n"
+    "    std::string token;\n"
+    "    while (SkipMisc(parser, token))\n"
+    "    {\n"
+    "        if (token == \"</\") return EndTag(parser);\n"
+    "        else if (token == \"<\") { if (SkipElement(parser) == false) return false; }\n"
+    "        else while (parser.HasToken() && parser.Character() != '<') ++parser;\n"
+    "    }\n"
+    "    return false;\n"
+    "}\n"
+    "\n"
+    "template<typename T> inline bool ReadElement(Parser& parser, T& value)\n"
+    "{\n"
+    "    std::string tag = StartTag(parser);\n"
+    "    if (tag == \"/>\")\n"
+    "        return (parser += 2, true);\n"
+    "    if (tag != \">\")\n"
+    "        return false;\n"
+    "    parser += 1;\n"
+    "    parser.SkipSpaces();\n"
+    "    return (ReadText(parser, value) && parser.CurrentToken() == \"</\" && EndTag(parser));\n"
+    "}\n"
+    "\n"
+    "// The name of the element that starts at the cursor\n"
+    "inline std::string ElementName(const Parser& parser)\n"
+    "{\n"
+    "    Parser peek(parser);\n"
+    "    return peek.NextToken();\n"
+    "}\n"
+    "\n"
+    "}\n"
+    "\n";
+
+static void WriteParser(ostream& out, const Struct& s)
+{
+    out << "inline bool Parse(xmlbind::Parser& parser, " << s.name << "& out)\n"
+        << "{\n"
+        << "    std::string token = parser.NextToken();\n"
+        << "    token = parser.NextToken();\n"
+        << "    while (token != \">\" && token != \"/>\")\n"
+        << "    {\n"
+        << "        if (parser.HasToken() == false || token.empty())\n"
+        << "            return false;\n"
+        << "        std::string key = token;\n"
+        << "        if ((token = parser.NextToken()) != \"=\")\n"
+        << "            continue;\n"
+        << "        parser.NextToken();\n";
+
+    bool first = true;
+    for (size_t i = 0; i < s.fields.size(); i++)
+    {
+        const Field& f = s.fields[i];
+        if (f.kind != "attribute")
+            continue;
+        out << "        " << (first ? "if" : "else if") << " (key == \"" << f.name << "\") { if (xmlbind::ReadAttribute(parser, out." << f.field << ") == false) return false; }\n";
+        first = false;
+    }
+
+    out << "        token = parser.NextToken();\n"
+        << "    }\n"
+        << "    if (token == \"/>\")\n"
+        << "        return (parser += 2, true);\n"
+        << "    parser += 1;\n"
+        << "\n"
+        << "    while (xmlbind::SkipMisc(parser, token))\n"
+        << "    {\n"
+        << "        if (token == \"</\")\n"
+        << "            return xmlbind::EndTag(parser);\n"
+        << "        else if (token == \"<\")\n"
+        << "        {\n"
+        << "            std::string name = xmlbind::ElementName(parser);\n";
+
+    first = true;
+    for (size_t i = 0; i < s.fields.size(); i++)
+    {
+        const Field& f = s.fields[i];
+        if (f.kind != "element")
+            continue;
+
+        string target = "out." + f.field;
+        out << "            " << (first ? "if" : "else if") << " (name == \"" << f.name << "\")\n"
+            << "            {\n";
+        if (f.list)
+        {
+            out << "                " << target << ".push_back(" << (f.type == "string" ? "std::string" : f.type) << "());\n";
+            target += ".back()";
+        }
+        if (IsPrimitive(f.type))
+            out << "                if (xmlbind::ReadElement(parser, " << target << ") == false) return false;\n";
+        else
+            out << "                if (Parse(parser, " << target << ") == false) return false;\n";
+        out << "            }\n";
+        first = false;
+    }
+
+    out << "            " << (first ? "" : "else ") << "if (xmlbind::SkipElement(parser) == false)\n"
+        << "                return false;\n"
+        << "        }\n";
+
+    const Field* text = 0;
+    for (size_t i = 0; i < s.fields.size(); i++)
+        if (s.fields[i].kind == "text")
+            text = &s.fields[i];
+
+    out << "        else\n";
+    if (text != 0)
+        out << "        {\n"
+            << "            if (xmlbind::ReadText(parser, out." << text->field << ") == false)\n"
+            << "                return false;\n"
+            << "        }\n";
+    else
+        out << "            while (parser.HasToken() && parser.Character() != '<') ++parser;\n";
+
+    out << "    }\n"
+        << "    return false;\n"
+        << "}\n"
+        << "\n"
+        << "inline bool Parse(const std::string& xml, " << s.name << "& out)\n"
+        << "{\n"
+        << "    xmlbind::Parser parser(xml);\n"
+        << "    if (xml.compare(0, 3, \"\\xEF\\xBB\\xBF\") == 0)\n"
+        << "        parser += 3;\n"
+        << "    std::string token;\n"
+        << "    if (xmlbind::SkipMisc(parser, token) == false || token != \"<\" || xmlbind::ElementName(parser) != \"" << s.element << "\")\n"
+        << "        return false;\n"
+        << "    return Parse(parser, out);\n"
+        << "}\n"
+        << "\n";
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc != 3)
+    {
+        cerr << "usage: " << argv[0] << " <schema.xml> <output.h>" << endl;
+        return 1;
+    }
+
+    XmlDocument schema;
+    try
+    {
+        if (schema.Load(argv[1]) == false)
+        {
+            cerr << "Error loading schema " << argv[1] << endl;
+            return 1;
+        }
+    }
+    catch (const string& err)
+    {
+        cerr << err << endl;
+        return 1;
+    }
+
+    map<string, Struct> structs;
+    vector<string> declared;
+    for (XmlNodeList::iterator i = schema.DocumentElement()->ChildNodes().begin(); i != schema.DocumentElement()->ChildNodes().end(); ++i)
+    {
+        if ((*i)->LocalName() != "struct")
+            continue;
+
+        Struct s;
+        s.name = Attribute(*i, "name");
+        s.element = Attribute(*i, "element", s.name);
+        for (XmlNodeList::iterator j = (*i)->ChildNodes().begin(); j != (*i)->ChildNodes().end(); ++j)
+        {
+            const string& kind = (*j)->LocalName();
+            if (kind != "attribute" && kind != "element" && kind != "text")
+                continue;
+
+            Field f;
+            f.kind = kind;
+            f.name = Attribute(*j, "name");
+            f.field = Attribute(*j, "field", f.name);
+            f.type = Attribute(*j, "type", "string");
+            f.list = (kind == "element" && Attribute(*j, "list") == "true");
+            if (kind != "element" && IsPrimitive(f.type) == false)
+            {
+                cerr << "Field " << s.name << "::" << f.field << " must have a primitive type" << endl;
+                return 1;
+            }
+            s.fields.push_back(f);
+        }
+
+        structs[s.name] = s;
+        declared.push_back(s.name);
+    }
+
+    for (map<string, Struct>::iterator i = structs.begin(); i != structs.end(); ++i)
+    {
+        for (size_t j = 0; j < i->second.fields.size(); j++)
+        {
+            const string& type = i->second.fields[j].type;
+            if (IsPrimitive(type) == false && structs.find(type) == structs.end())
+            {
+                cerr << "Unknown type " << type << " in " << i->first << endl;
+                return 1;
+            }
+        }
+    }
+
+    set<string> done;
+    vector<string> order;
+    for (size_t i = 0; i < declared.size(); i++)
+        Order(declared[i], structs, done, order);
+
+    string guard = "XMLBIND_" + Attribute(schema.DocumentElement(), "namespace", "schema") + "_H";
+    for (size_t i = 0; i < guard.size(); i++)
+        guard[i] = (isalnum((unsigned char)guard[i]) ? toupper((unsigned char)guard[i]) : '_');
+
+    ostringstream out;
+    out << "// Generated by xmlbind from " << argv[1] << ", do not edit\n"
+        << "#ifndef " << guard << "\n"
+        << "#define " << guard << "\n"
+        << "\n"
+        << "#include <algorithm>\n"
+        << "#include <cerrno>\n"
+        << "#include <climits>\n"
+        << "#include <cstdlib>\n"
+        << "#include <cstring>\n"
+        << "#include <string>\n"
+        << "#include <vector>\n"
+        << "#include \"xml.h\"\n"
+        << "\n";
+
+    string ns = Attribute(schema.DocumentElement(), "namespace");
+    if (ns.empty() == false)
+        out << "namespace " << ns << "\n{\n\n";
+
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        const Struct& s = structs[order[i]];
+        out << "struct " << s.name << "\n{\n";
+
+        string init;
+        for (size_t j = 0; j < s.fields.size(); j++)
+        {
+            const Field& f = s.fields[j];
+            out << "    " << CppType(f) << " " << f.field << ";\n";
+            if (f.list == false && DefaultValue(f.type).empty() == false)
+                init += string(init.empty() ? " : " : ", ") + f.field + "(" + DefaultValue(f.type) + ")";
+        }
+
+        out << "\n    " << s.name << "()" << init << " { }\n"
+            << "};\n"
+            << "\n";
+    }
+
+    out << Runtime;
+
+    for (size_t i = 0; i < order.size(); i++)
+        out << "inline bool Parse(xmlbind::Parser& parser, " << order[i] << "& out);\n";
+    out << "\n";
+
+    for (size_t i = 0; i < order.size(); i++)
+        WriteParser(out, structs[order[i]]);
+
+    if (ns.empty() == false)
+        out << "}\n\n";
+    out << "#endif // " << guard << "\n";
+
+    ofstream ofs(argv[2]);
+    ofs << out.str();
+    if (!ofs)
+    {
+        cerr << "Error writing " << argv[2] << endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,189 @@
+#include "xml.h"
+
+using namespace std;
+using namespace common::xml;
+
+// 64 bit FNV-1a
+static XmlHash HashBytes(XmlHash hash, const char* data, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= (unsigned char)data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static XmlHash HashValue(XmlHash hash, XmlHash value)
+{
+    for (int i = 0; i < 8; i++)
+    {
+        hash ^= (value & 0xff);
+        hash *= 1099511628211ULL;
+        value >>= 8;
+    }
+    return hash;
+}
+
+// The length is mixed in first so concatenated fields can not collide
+static XmlHash HashString(XmlHash hash, const string& value)
+{
+    return HashBytes(HashValue(hash, value.size()), value.c_str(), value.size());
+}
+
+static const XmlHash HashSeed = 14695981039346656037ULL;
+
+////////////////////////////////////////////////////////////////////////////////////
+// Content hashes
+////////////////////////////////////////////////////////////////////////////////////
+XmlHash XmlNode::Hash()
+{
+    if (this->_hashValid == false)
+    {
+        this->_hash = this->ComputeHash();
+        this->_hashValid = true;
+    }
+    return this->_hash;
+}
+
+XmlHash XmlNode::ComputeHash()
+{
+    XmlHash hash = HashString(HashSeed, this->_localName);
+
+    hash = HashValue(hash, this->_attributes.size());
+    for (XmlAttributeCollection::iterator i = this->_attributes.begin(); i != this->_attributes.end(); ++i)
+        hash = HashValue(hash, (*i).second->Hash());
+
+    hash = HashValue(hash, this->_childNodes.size());
+    for (XmlNodeList::iterator i = this->_childNodes.begin(); i != this->_childNodes.end(); ++i)
+        hash = HashValue(hash, (*i)->Hash());
+
+    return hash;
+}
+
+XmlHash XmlCharacterData::ComputeHash()
+{
+    return HashString(HashString(HashSeed, this->_localName), this->_data);
+}
+
+XmlHash XmlText::ComputeHash()
+{
+    return HashString(HashString(HashSeed, "#text"), this->_data);
+}
+
+XmlHash XmlComment::ComputeHash()
+{
+    return HashString(HashString(HashSeed, this->_localName), this->Comment());
+}
+
+XmlHash XmlAttribute::ComputeHash()
+{
+    return HashString(HashString(HashSeed, this->_localName), this->_value);
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+// Diff
+////////////////////////////////////////////////////////////////////////////////////
+static bool SameAttributes(XmlNode* a, XmlNode* b)
+{
+    if (a->Attributes().size() != b->Attributes().size())
+        return false;
+
+    XmlAttributeCollection::iterator j = b->Attributes().begin();
+    for (XmlAttributeCollection::iterator i = a->Attributes().begin(); i != a->Attributes().end(); ++i, ++j)
+    {
+        if ((*i).first != (*j).first || (*i).second->Hash() != (*j).second->Hash())
+            return false;
+    }
+
+    return true;
+}
+
+static void Diff(XmlNode* a, XmlNode* b, XmlNodeChangeList& changes);
+
+// Children without a partner by hash are paired up in order, what is left over was added or removed
+static void DiffRun(XmlNodeList& a, size_t aBegin, size_t aEnd, XmlNodeList& b, size_t bBegin, size_t bEnd, XmlNodeChangeList& changes)
+{
+    while (aBegin < aEnd && bBegin < bEnd)
+        Diff(a[aBegin++], b[bBegin++], changes);
+    while (aBegin < aEnd)
+        changes.push_back(make_pair(a[aBegin++], (XmlNode*)0));
+    while (bBegin < bEnd)
+        changes.push_back(make_pair((XmlNode*)0, b[bBegin++]));
+}
+
+static void DiffChildren(XmlNodeList& a, XmlNodeList& b, XmlNodeChangeList& changes)
+{
+    // Unchanged children at the start and the end are the common case, they are skipped first
+    size_t aBegin = 0, bBegin = 0, aEnd = a.size(), bEnd = b.size();
+    while (aBegin < aEnd && bBegin < bEnd && a[aBegin]->Hash() == b[bBegin]->Hash())
+        aBegin++, bBegin++;
+    while (aBegin < aEnd && bBegin < bEnd && a[aEnd-1]->Hash() == b[bEnd-1]->Hash())
+        aEnd--, bEnd--;
+
+    // The rest is aligned on equal hashes, in order, each one matching the first unused partner
+    map<XmlHash, vector<size_t> > positions;
+    for (size_t j = bEnd; j > bBegin; j--)
+        positions[b[j-1]->Hash()].push_back(j-1);
+
+    size_t aRun = aBegin, bRun = bBegin;
+    for (size_t i = aBegin; i < aEnd; i++)
+    {
+        map<XmlHash, vector<size_t> >::iterator found = positions.find(a[i]->Hash());
+        if (found == positions.end())
+            continue;
+
+        // Positions are stored back to front, so the nearest one is at the end
+        vector<size_t>& candidates = found->second;
+        while (candidates.empty() == false && candidates.back() < bRun)
+            candidates.pop_back();
+        if (candidates.empty())
+            continue;
+
+        size_t j = candidates.back();
+        candidates.pop_back();
+        DiffRun(a, aRun, i, b, bRun, j, changes);
+        aRun = i + 1;
+        bRun = j + 1;
+    }
+    DiffRun(a, aRun, aEnd, b, bRun, bEnd, changes);
+}
+
+static void Diff(XmlNode* a, XmlNode* b, XmlNodeChangeList& changes)
+{
+    if (a->Hash() == b->Hash())
+        return;
+
+    // Text, comments and elements that differ in themselves are reported whole,
+    // only the children of otherwise equal elements are compared further
+    if (a->LocalName() != b->LocalName()
+            || (a->ChildNodes().empty() && b->ChildNodes().empty())
+            || SameAttributes(a, b) == false)
+    {
+        changes.push_back(make_pair(a, b));
+        return;
+    }
+
+    DiffChildren(a->ChildNodes(), b->ChildNodes(), changes);
+}
+
+XmlNodeChangeList XmlNode::Diff(XmlNode* other)
+{
+    XmlNodeChangeList changes;
+
+    ::Diff(this, other, changes);
+
+    return changes;
+}
+
+XmlNodeChangeList XmlDocument::Diff(XmlDocument& other)
+{
+    XmlNodeChangeList changes;
+
+    if (this->_documentElement != 0 && other._documentElement != 0)
+        ::Diff(this->_documentElement, other._documentElement, changes);
+    else if (this->_documentElement != other._documentElement)
+        changes.push_back(make_pair(this->_documentElement, other._documentElement));
+
+    return changes;
+}
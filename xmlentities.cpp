@@ -0,0 +1,262 @@
+#include "xml.h"
+#include <cstring>
+#include <cstdlib>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define COMMON_XML_SSE2
+#endif
+
+using namespace std;
+using namespace common::xml;
+
+static bool IsSpecial(char c, bool attribute)
+{
+    return (c == '&' || c == '<' || c == '>' || (attribute && c == '\"'));
+}
+
+// Position of the first character that needs escaping, or size when there is none
+static size_t FindSpecial(const char* data, size_t size, bool attribute)
+{
+    size_t i = 0;
+
+#ifdef COMMON_XML_SSE2
+    const __m128i amp = _mm_set1_epi8('&');
+    const __m128i lt = _mm_set1_epi8('<');
+    const __m128i gt = _mm_set1_epi8('>');
+    const __m128i quot = _mm_set1_epi8(attribute ? '\"' : '&');
+    for (; i + 16 <= size; i += 16)
+    {
+        __m128i chunk = _mm_loadu_si128((const __m128i*)(data + i));
+        __m128i hits = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, amp), _mm_cmpeq_epi8(chunk, lt)),
+                                    _mm_or_si128(_mm_cmpeq_epi8(chunk, gt), _mm_cmpeq_epi8(chunk, quot)));
+        int mask = _mm_movemask_epi8(hits);
+        if (mask != 0)
+        {
+            while ((mask & 1) == 0)
+            {
+                mask >>= 1;
+                i++;
+            }
+            return i;
+        }
+    }
+#endif
+
+    for (; i < size; i++)
+        if (IsSpecial(data[i], attribute))
+            return i;
+
+    return size;
+}
+
+static void AppendUtf8(string& result, unsigned long code)
+{
+    if (code < 0x80)
+        result += char(code);
+    else if (code < 0x800)
+    {
+        result += char(0xC0 | (code >> 6));
+        result += char(0x80 | (code & 0x3F));
+    }
+    else if (code < 0x10000)
+    {
+        result += char(0xE0 | (code >> 12));
+        result += char(0x80 | ((code >> 6) & 0x3F));
+        result += char(0x80 | (code & 0x3F));
+    }
+    else
+    {
+        result += char(0xF0 | (code >> 18));
+        result += char(0x80 | ((code >> 12) & 0x3F));
+        result += char(0x80 | ((code >> 6) & 0x3F));
+        result += char(0x80 | (code & 0x3F));
+    }
+}
+
+static bool DecodeEntity(const string& name, string& result)
+{
+    if (name == "amp") result += '&';
+    else if (name == "lt") result += '<';
+    else if (name == "gt") result += '>';
+    else if (name == "quot") result += '\"';
+    else if (name == "apos") result += '\'';
+    else if (name.size() > 1 && name[0] == '#')
+    {
+        char* end = 0;
+        unsigned long code = (name[1] == 'x' || name[1] == 'X')
+                ? strtoul(name.c_str() + 2, &end, 16)
+                : strtoul(name.c_str() + 1, &end, 10);
+        if (end == 0 || *end != '\0' || code == 0 || code > 0x10FFFF || (code >= 0xD800 && code <= 0xDFFF))
+            return false;
+        AppendUtf8(result, code);
+    }
+    else
+        return false;
+
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+// Entities
+////////////////////////////////////////////////////////////////////////////////////
+void priv::DecodeEntities(string& value)
+{
+    // Most values have no references at all, memchr is vectorized by the c library
+    const char* data = value.c_str();
+    const char* amp = (const char*)memchr(data, '&', value.size());
+    if (amp == 0)
+        return;
+
+    string result;
+    result.reserve(value.size());
+
+    size_t i = 0;
+    while (amp != 0)
+    {
+        size_t at = amp - data;
+        result.append(data + i, at - i);
+
+        size_t semicolon = value.find(';', at);
+        if (semicolon == string::npos || semicolon - at > 10 || DecodeEntity(value.substr(at + 1, semicolon - at - 1), result) == false)
+        {
+            // Not a reference we know, keep it as it is
+            result += '&';
+            i = at + 1;
+        }
+        else
+            i = semicolon + 1;
+
+        amp = (const char*)memchr(data + i, '&', value.size() - i);
+    }
+    result.append(data + i, value.size() - i);
+
+    value.swap(result);
+}
+
+void priv::AppendEscaped(string& result, const string& value, bool attribute)
+{
+    const char* data = value.c_str();
+    size_t size = value.size();
+
+    size_t i = 0;
+    size_t special = FindSpecial(data, size, attribute);
+    while (special < size)
+    {
+        result.append(data + i, special - i);
+        switch (data[special])
+        {
+        case '&': result += "&amp;"; break;
+        case '<': result += "&lt;"; break;
+        case '>': result += "&gt;"; break;
+        case '\"': result += "&quot;"; break;
+        }
+        i = special + 1;
+        special = i + FindSpecial(data + i, size - i, attribute);
+    }
+    result.append(data + i, size - i);
+}
+
+string priv::AttributeValue(const string& token)
+{
+    string value = token;
+    if (value.size() >= 2 && value[0] == '\"' && value[value.size()-1] == '\"')
+        value = value.substr(1, value.size()-2);
+    priv::DecodeEntities(value);
+    return value;
+}
+
+bool priv::FindAttribute(const vector<string>& tokens, const string& key, string& value)
+{
+    for (unsigned int i = 1; i + 1 < tokens.size(); i++)
+    {
+        if (tokens[i] == "=" && tokens[i-1] == key)
+        {
+            value = priv::AttributeValue(tokens[i+1]);
+            return true;
+        }
+    }
+    return false;
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+// Encoding
+////////////////////////////////////////////////////////////////////////////////////
+// Whether the bytes can still become a valid sequence once the rest of it arrives
+static bool IsUtf8Prefix(const unsigned char* bytes, size_t size)
+{
+    for (size_t j = 1; j < size; j++)
+    {
+        if ((bytes[j] & 0xC0) != 0x80)
+            return false;
+    }
+    if (size < 2)
+        return true;
+
+    // The second byte is enough to rule out overlong forms, surrogates and code points past the range
+    switch (bytes[0])
+    {
+    case 0xE0: return (bytes[1] >= 0xA0);
+    case 0xED: return (bytes[1] <= 0x9F);
+    case 0xF0: return (bytes[1] >= 0x90);
+    case 0xF4: return (bytes[1] <= 0x8F);
+    }
+    return true;
+}
+
+size_t priv::ValidUtf8Length(const char* data, size_t size, bool* truncated)
+{
+    const unsigned char* bytes = (const unsigned char*)data;
+    size_t i = 0;
+
+    if (truncated != 0)
+        *truncated = false;
+
+    while (i < size)
+    {
+#ifdef COMMON_XML_SSE2
+        // Skip whole blocks of ascii at once
+        while (i + 16 <= size && _mm_movemask_epi8(_mm_loadu_si128((const __m128i*)(bytes + i))) == 0)
+            i += 16;
+        if (i >= size)
+            break;
+#endif
+        unsigned char c = bytes[i];
+        if (c < 0x80)
+        {
+            i++;
+            continue;
+        }
+
+        size_t length;
+        unsigned long code;
+        if (c >= 0xC2 && c <= 0xDF) { length = 2; code = c & 0x1F; }
+        else if (c >= 0xE0 && c <= 0xEF) { length = 3; code = c & 0x0F; }
+        else if (c >= 0xF0 && c <= 0xF4) { length = 4; code = c & 0x07; }
+        else
+            return i;
+
+        if (i + length > size)
+        {
+            if (truncated != 0)
+                *truncated = IsUtf8Prefix(bytes + i, size - i);
+            return i;
+        }
+
+        for (size_t j = 1; j < length; j++)
+        {
+            if ((bytes[i + j] & 0xC0) != 0x80)
+                return i;
+            code = (code << 6) | (bytes[i + j] & 0x3F);
+        }
+
+        // Overlong forms, surrogates and code points past the unicode range
+        if ((length == 3 && code < 0x800) || (length == 4 && code < 0x10000)
+                || (code >= 0xD800 && code <= 0xDFFF) || code > 0x10FFFF)
+            return i;
+
+        i += length;
+    }
+
+    return size;
+}
@@ -0,0 +1,135 @@
+#include "xml.h"
+
+using namespace std;
+using namespace common::xml;
+
+// Each step is (descendant, name), a descendant step may skip any number of elements
+static bool MatchSteps(const vector<pair<bool, string> >& steps, size_t step, const vector<string>& names, size_t name)
+{
+    if (step == steps.size())
+        return (name == names.size());
+    if (name == names.size())
+        return false;
+
+    if (steps[step].second == "*" || steps[step].second == names[name])
+    {
+        if (MatchSteps(steps, step + 1, names, name + 1))
+            return true;
+    }
+
+    return (steps[step].first && MatchSteps(steps, step, names, name + 1));
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+// XmlPathFilter
+////////////////////////////////////////////////////////////////////////////////////
+XmlPathFilter::XmlPathFilter()
+    : XmlPushParser(0)
+{ }
+
+XmlPathFilter::~XmlPathFilter()
+{
+    if (this->_document != 0)
+        delete this->_document;
+    this->_document = 0;
+}
+
+bool XmlPathFilter::AddPath(const string& expression)
+{
+    Path path;
+    path.expression = expression;
+
+    const char* xpath = expression.c_str();
+    while (xpath[0] != '\0')
+    {
+        // Relative paths can start anywhere in the document
+        bool descendant = (xpath == expression.c_str() && xpath[0] != '/');
+        if (xpath[0] == '/' && xpath[1] == '/')
+        {
+            descendant = true;
+            xpath += 2;
+        }
+        else if (xpath[0] == '/')
+            xpath++;
+
+        string name;
+        while (xpath[0] != '/' && xpath[0] != '\0')
+        {
+            name += xpath[0];
+            ++xpath;
+        }
+
+        if (name.size() > 1 && name[0] == '@' && xpath[0] == '\0')
+        {
+            path.attribute = name.substr(1);
+            // //@id is read as //*/@id
+            if (path.steps.empty())
+                path.steps.push_back(make_pair(descendant, string("*")));
+        }
+        else if (name.empty() == false)
+            path.steps.push_back(make_pair(descendant, name));
+    }
+
+    if (path.steps.empty())
+        return false;
+
+    this->_paths.push_back(path);
+    return true;
+}
+
+void XmlPathFilter::OnMatch(const string& path, XmlNode* node)
+{ }
+
+void XmlPathFilter::OnMatch(const string& path, const string& value)
+{ }
+
+void XmlPathFilter::OnStartElement(const vector<string>& tokens)
+{
+    this->_names.push_back(tokens[0]);
+
+    vector<size_t> matches;
+    for (size_t i = 0; i < this->_paths.size(); i++)
+    {
+        const Path& path = this->_paths[i];
+        if (MatchSteps(path.steps, 0, this->_names, 0) == false)
+            continue;
+
+        string value;
+        if (path.attribute.empty())
+            matches.push_back(i);
+        else if (priv::FindAttribute(tokens, path.attribute, value))
+            this->OnMatch(path.expression, value);
+    }
+
+    // Only a matching element, and everything inside it, is turned into nodes
+    if (this->_document == 0 && matches.empty() == false)
+        this->_document = new XmlDocument();
+
+    if (this->_document != 0)
+    {
+        XmlPushParser::OnStartElement(tokens);
+        this->_captures.push_back(matches);
+    }
+}
+
+void XmlPathFilter::OnEndElement(const string& localname)
+{
+    this->_names.pop_back();
+
+    if (this->_document == 0)
+        return;
+
+    XmlNode* node = this->_openNodes.back();
+    const vector<size_t>& matches = this->_captures.back();
+    for (size_t i = 0; i < matches.size(); i++)
+        this->OnMatch(this->_paths[matches[i]].expression, node);
+
+    XmlPushParser::OnEndElement(localname);
+    this->_captures.pop_back();
+
+    if (this->_captures.empty())
+    {
+        delete this->_document;
+        this->_document = 0;
+    }
+}
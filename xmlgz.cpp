@@ -0,0 +1,175 @@
+#include "xml.h"
+
+#ifdef COMMON_XML_WITH_ZLIB
+
+#include <zlib.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+using namespace std;
+using namespace common::xml;
+
+namespace common
+{
+
+namespace xml
+{
+
+namespace priv
+{
+
+// Fixed set of chunks handed from the decompressing thread to the parsing thread
+class XmlChunkRing
+{
+public:
+    enum { ChunkCount = 8, ChunkSize = 64 * 1024 };
+
+    XmlChunkRing()
+        : _head(0), _count(0), _closed(false), _failed(false)
+    { }
+
+    // Producer side: returns the chunk to fill, or 0 when the consumer gave up
+    char* BeginWrite()
+    {
+        unique_lock<mutex> lock(this->_mutex);
+        this->_notFull.wait(lock, [this] { return this->_count < ChunkCount || this->_closed; });
+        if (this->_closed)
+            return 0;
+        return this->_chunks[(this->_head + this->_count) % ChunkCount];
+    }
+
+    void EndWrite(size_t size)
+    {
+        unique_lock<mutex> lock(this->_mutex);
+        this->_sizes[(this->_head + this->_count) % ChunkCount] = size;
+        this->_count++;
+        this->_notEmpty.notify_one();
+    }
+
+    // Consumer side: returns the next filled chunk, or 0 at the end of the stream
+    const char* BeginRead(size_t& size)
+    {
+        unique_lock<mutex> lock(this->_mutex);
+        this->_notEmpty.wait(lock, [this] { return this->_count > 0 || this->_closed; });
+        if (this->_count == 0)
+            return 0;
+        size = this->_sizes[this->_head];
+        return this->_chunks[this->_head];
+    }
+
+    void EndRead()
+    {
+        unique_lock<mutex> lock(this->_mutex);
+        this->_head = (this->_head + 1) % ChunkCount;
+        this->_count--;
+        this->_notFull.notify_one();
+    }
+
+    void Close(bool failed)
+    {
+        unique_lock<mutex> lock(this->_mutex);
+        this->_closed = true;
+        this->_failed = this->_failed || failed;
+        this->_notEmpty.notify_all();
+        this->_notFull.notify_all();
+    }
+
+    bool Failed()
+    {
+        unique_lock<mutex> lock(this->_mutex);
+        return this->_failed;
+    }
+
+private:
+    char _chunks[ChunkCount][ChunkSize];
+    size_t _sizes[ChunkCount];
+    int _head;
+    int _count;
+    bool _closed;
+    bool _failed;
+    mutex _mutex;
+    condition_variable _notEmpty;
+    condition_variable _notFull;
+
+};
+
+}
+
+}   // common
+
+}   // xml
+
+static void Decompress(gzFile file, priv::XmlChunkRing* ring)
+{
+    char* chunk = ring->BeginWrite();
+    while (chunk != 0)
+    {
+        int size = gzread(file, chunk, priv::XmlChunkRing::ChunkSize);
+        if (size <= 0)
+        {
+            ring->Close(size < 0);
+            return;
+        }
+        ring->EndWrite(size);
+        chunk = ring->BeginWrite();
+    }
+}
+
+bool XmlDocument::LoadCompressed(const string& filename)
+{
+    gzFile file = gzopen(filename.c_str(), "rb");
+    if (file == 0)
+        return false;
+
+    // Decompression runs ahead of the parser by at most ChunkCount chunks
+    priv::XmlChunkRing* ring = new priv::XmlChunkRing();
+    thread decompressor(Decompress, file, ring);
+
+    XmlNode* declaration = this->_declaration;
+    XmlNode* documentElement = this->_documentElement;
+    this->_declaration = this->_documentElement = 0;
+
+    XmlPushParser parser(this);
+    parser.ValidateEncoding(this->_validateEncoding);
+
+    size_t size;
+    bool parsed = true;
+    const char* chunk = ring->BeginRead(size);
+    while (chunk != 0)
+    {
+        parsed = parser.Feed(chunk, size);
+        ring->EndRead();
+        if (parsed == false)
+            break;
+        chunk = ring->BeginRead(size);
+    }
+
+    // Stops the decompressor when the parser gave up early
+    ring->Close(parsed == false);
+    decompressor.join();
+    gzclose(file);
+
+    bool result = (parsed && ring->Failed() == false && parser.Finish());
+    delete ring;
+
+    this->EndLoad(result, declaration, documentElement);
+
+    if (result == false)
+        priv::ThrowParseError(parser.Result());
+
+    return result;
+}
+
+#else
+
+using namespace std;
+using namespace common::xml;
+
+bool XmlDocument::LoadCompressed(const string& filename)
+{
+    // Built without zlib
+    return false;
+}
+
+#endif // COMMON_XML_WITH_ZLIB
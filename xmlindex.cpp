@@ -0,0 +1,200 @@
+#include "xml.h"
+#include <fstream>
+#include <sstream>
+
+using namespace std;
+using namespace common::xml;
+
+// Records the byte range of every element at one depth, without building nodes
+class XmlIndexer : public XmlPushParser
+{
+public:
+    XmlIndexer(vector<XmlIndexEntry>& entries, int depth, const string& keyAttribute)
+        : XmlPushParser(0), _entries(entries), _depth(depth), _keyAttribute(keyAttribute), _level(-1)
+    { }
+
+protected:
+    virtual void OnStartElement(const vector<string>& tokens)
+    {
+        if (++this->_level != this->_depth)
+            return;
+
+        XmlIndexEntry entry;
+        entry.offset = this->TokenOffset();
+        entry.length = 0;
+        if (this->_keyAttribute.empty() == false)
+            priv::FindAttribute(tokens, this->_keyAttribute, entry.key);
+        this->_entries.push_back(entry);
+    }
+
+    virtual void OnEndElement(const string& localname)
+    {
+        if (this->_level-- != this->_depth)
+            return;
+
+        XmlIndexEntry& entry = this->_entries.back();
+        entry.length = this->TokenEnd() - entry.offset;
+    }
+
+private:
+    vector<XmlIndexEntry>& _entries;
+    int _depth;
+    string _keyAttribute;
+    int _level;
+
+};
+
+// Keys are written escaped, a decoded &#10; or &#9; would otherwise break the line format
+static string EscapeKey(const string& key)
+{
+    string result;
+    for (size_t i = 0; i < key.size(); i++)
+    {
+        switch (key[i])
+        {
+        case '\\': result += "\\\\"; break;
+        case '\t': result += "\\t"; break;
+        case '\n': result += "\\n"; break;
+        case '\r': result += "\\r"; break;
+        default: result += key[i]; break;
+        }
+    }
+    return result;
+}
+
+static string UnescapeKey(const string& key)
+{
+    string result;
+    for (size_t i = 0; i < key.size(); i++)
+    {
+        if (key[i] != '\\' || i + 1 == key.size())
+        {
+            result += key[i];
+            continue;
+        }
+        switch (key[++i])
+        {
+        case 't': result += '\t'; break;
+        case 'n': result += '\n'; break;
+        case 'r': result += '\r'; break;
+        default: result += key[i]; break;
+        }
+    }
+    return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+// XmlRecordIndex
+////////////////////////////////////////////////////////////////////////////////////
+XmlRecordIndex::XmlRecordIndex()
+{ }
+
+XmlRecordIndex::~XmlRecordIndex()
+{ }
+
+bool XmlRecordIndex::Build(const string& filename, int depth, const string& keyAttribute)
+{
+    ifstream ifs(filename.c_str(), ios::in | ios::binary);
+    if (!ifs)
+        return false;
+
+    this->_entries.clear();
+    this->_keys.clear();
+
+    XmlIndexer indexer(this->_entries, depth, keyAttribute);
+    char chunk[64 * 1024];
+    while (ifs.read(chunk, sizeof(chunk)) || ifs.gcount() > 0)
+    {
+        if (indexer.Feed(chunk, ifs.gcount()) == false)
+            return false;
+    }
+
+    if (indexer.Finish() == false)
+        return false;
+
+    for (size_t i = 0; i < this->_entries.size(); i++)
+        if (this->_entries[i].key.empty() == false)
+            this->_keys.insert(make_pair(this->_entries[i].key, i));
+
+    return true;
+}
+
+bool XmlRecordIndex::Save(const string& filename) const
+{
+    ofstream ofs(filename.c_str(), ios::out | ios::binary);
+
+    // One record per line: offset, length and the (optional) escaped key, tab separated
+    for (size_t i = 0; i < this->_entries.size(); i++)
+        ofs << this->_entries[i].offset << '\t' << this->_entries[i].length << '\t' << EscapeKey(this->_entries[i].key) << '\n';
+
+    return ofs.good();
+}
+
+bool XmlRecordIndex::Load(const string& filename)
+{
+    ifstream ifs(filename.c_str(), ios::in | ios::binary);
+    if (!ifs)
+        return false;
+
+    this->_entries.clear();
+    this->_keys.clear();
+
+    string line;
+    while (getline(ifs, line))
+    {
+        istringstream iss(line);
+        XmlIndexEntry entry;
+        if (!(iss >> entry.offset >> entry.length))
+            return false;
+        iss.get();
+        getline(iss, entry.key);
+        entry.key = UnescapeKey(entry.key);
+
+        if (entry.key.empty() == false)
+            this->_keys.insert(make_pair(entry.key, this->_entries.size()));
+        this->_entries.push_back(entry);
+    }
+
+    return true;
+}
+
+const XmlIndexEntry* XmlRecordIndex::Find(const string& key) const
+{
+    map<string, size_t>::const_iterator found = this->_keys.find(key);
+    if (found == this->_keys.end())
+        return 0;
+
+    return &this->_entries[found->second];
+}
+
+bool XmlRecordIndex::LoadRecord(const string& filename, size_t index, XmlDocument& document) const
+{
+    if (index >= this->_entries.size())
+        return false;
+
+    return this->LoadRecord(filename, this->_entries[index], document);
+}
+
+bool XmlRecordIndex::LoadRecord(const string& filename, const string& key, XmlDocument& document) const
+{
+    const XmlIndexEntry* entry = this->Find(key);
+    if (entry == 0)
+        return false;
+
+    return this->LoadRecord(filename, *entry, document);
+}
+
+bool XmlRecordIndex::LoadRecord(const string& filename, const XmlIndexEntry& entry, XmlDocument& document) const
+{
+    ifstream ifs(filename.c_str(), ios::in | ios::binary);
+    if (!ifs)
+        return false;
+
+    ifs.seekg(streamoff(entry.offset));
+
+    string xml(size_t(entry.length), '\0');
+    if (!ifs.read(&xml[0], xml.size()))
+        return false;
+
+    return document.LoadXml(xml);
+}
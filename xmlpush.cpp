@@ -0,0 +1,400 @@
+#include "xml.h"
+#include <cstring>
+
+using namespace std;
+using namespace common::xml;
+
+////////////////////////////////////////////////////////////////////////////////////
+// XmlPushParser
+////////////////////////////////////////////////////////////////////////////////////
+XmlPushParser::XmlPushParser(XmlDocument* document)
+    : _document(document), _offset(0), _position(0), _resume(0), _tokenStart(0), _tokenEnd(0),
+      _tagQuote(0), _tagSubset(0), _validateEncoding(false), _validated(0)
+{ }
+
+XmlPushParser::~XmlPushParser()
+{ }
+
+bool XmlPushParser::Feed(const char* data, size_t size)
+{
+    if (this->_result.error != XmlParseOk)
+        return false;
+
+    this->_buffer.append(data, size);
+
+    if (this->_validateEncoding)
+    {
+        // Only a sequence split over two chunks is left to check when the rest arrives, no token
+        // can end inside it so Parse() never consumes past _validated
+        bool truncated = false;
+        this->_validated += priv::ValidUtf8Length(this->_buffer.c_str() + this->_validated, this->_buffer.size() - this->_validated, &truncated);
+        if (this->_validated != this->_buffer.size() && truncated == false)
+        {
+            this->_tokenStart = this->_validated;
+            this->Fail(XmlParseInvalidEncoding, "utf-8");
+            return false;
+        }
+    }
+
+    this->Parse();
+
+    // Drop everything that was consumed, only a partial token is kept for the next chunk
+    if (this->_position > 0)
+    {
+        this->_buffer.erase(0, this->_position);
+        this->_offset += this->_position;
+        this->_resume -= this->_position;
+        this->_validated -= this->_position;
+        this->_position = 0;
+    }
+
+    return (this->_result.error == XmlParseOk);
+}
+
+bool XmlPushParser::Finish()
+{
+    if (this->_result.error != XmlParseOk)
+        return false;
+
+    if (this->_validateEncoding && this->_validated != this->_buffer.size())
+    {
+        this->_tokenStart = this->_validated;
+        this->Fail(XmlParseInvalidEncoding, "utf-8");
+        return false;
+    }
+
+    this->Parse();
+    if (this->_result.error != XmlParseOk)
+        return false;
+
+    // Whatever is left is either trailing text or a tag that was never closed
+    for (size_t i = this->_position; i < this->_buffer.size(); i++)
+    {
+        if ((unsigned char)this->_buffer[i] > ' ')
+        {
+            this->_tokenStart = i;
+            if (this->_buffer[i] != '<' && this->_openElements.empty())
+                this->Fail(XmlParseUnexpectedToken, "end of document");
+            else if (this->_buffer[i] != '<')
+                this->Fail(XmlParseUnexpectedEnd, "</" + this->_openElements.back() + ">");
+            else if (this->StartsWith(i, "<!--") > 0)
+                this->Fail(XmlParseUnexpectedEnd, "-->");
+            else if (this->StartsWith(i, "<![CDATA[") > 0)
+                this->Fail(XmlParseUnexpectedEnd, "]]>");
+            else if (this->StartsWith(i, "<?") > 0)
+                this->Fail(XmlParseUnexpectedEnd, "?>");
+            else
+                this->Fail(XmlParseUnexpectedEnd, ">");
+            return false;
+        }
+    }
+
+    this->_tokenStart = this->_buffer.size();
+    if (this->_openElements.empty() == false)
+        this->Fail(XmlParseUnexpectedEnd, "</" + this->_openElements.back() + ">");
+    else if (this->_document != 0 && this->_document->_documentElement == 0)
+        this->Fail(XmlParseNoDocumentElement, "<");
+
+    return (this->_result.error == XmlParseOk);
+}
+
+void XmlPushParser::Fail(XmlParseError error, const string& expected, const string& found)
+{
+    if (this->_result.error != XmlParseOk)
+        return;
+
+    priv::Fail(this->_result, error, this->TokenOffset(), expected, found);
+}
+
+int XmlPushParser::StartsWith(size_t at, const char* literal) const
+{
+    size_t length = strlen(literal);
+    size_t available = this->_buffer.size() - at;
+    size_t count = (available < length ? available : length);
+
+    if (this->_buffer.compare(at, count, literal, count) != 0)
+        return 0;
+
+    return (count == length ? 1 : -1);
+}
+
+void XmlPushParser::Parse()
+{
+    // A utf-8 byte order mark is allowed before anything else
+    if (this->_offset == 0 && this->_position == 0)
+    {
+        int bom = this->StartsWith(0, "\xEF\xBB\xBF");
+        if (bom < 0)
+            return;
+        if (bom > 0)
+            this->_position = this->_resume = 3;
+    }
+
+    while (this->_position < this->_buffer.size() && this->_result.error == XmlParseOk)
+    {
+        size_t start = this->_position;
+        size_t from = (this->_resume > start ? this->_resume : start);
+
+        // regular text, runs until the next tag
+        if (this->_buffer[start] != '<')
+        {
+            size_t end = this->_buffer.find('<', from);
+            if (end == string::npos)
+            {
+                this->_resume = this->_buffer.size();
+                return;
+            }
+
+            this->_tokenStart = start;
+            this->_tokenEnd = end;
+            while (start < end && (unsigned char)this->_buffer[start] <= ' ')
+                start++;
+            if (start < end)
+            {
+                string text = this->_buffer.substr(start, end - start);
+                priv::DecodeEntities(text);
+                this->OnText(text);
+            }
+
+            this->_position = this->_resume = end;
+            continue;
+        }
+
+        int comment = this->StartsWith(start, "<!--");
+        int cdata = this->StartsWith(start, "<![CDATA[");
+        int instruction = this->StartsWith(start, "<?");
+        if (comment < 0 || cdata < 0 || instruction < 0)
+            return;
+
+        // <!-- -->
+        if (comment > 0)
+        {
+            if (from < start + 4) from = start + 4;
+            size_t end = this->_buffer.find("-->", from);
+            if (end == string::npos)
+            {
+                this->_resume = this->_buffer.size() - 2;
+                return;
+            }
+            this->_tokenStart = start;
+            this->_tokenEnd = end + 3;
+            this->OnComment(this->_buffer.substr(start + 4, end - start - 4));
+            this->_position = this->_resume = end + 3;
+        }
+        // <![CDATA[ ]]>
+        else if (cdata > 0)
+        {
+            if (from < start + 9) from = start + 9;
+            size_t end = this->_buffer.find("]]>", from);
+            if (end == string::npos)
+            {
+                this->_resume = this->_buffer.size() - 2;
+                return;
+            }
+            this->_tokenStart = start;
+            this->_tokenEnd = end + 3;
+            this->OnCharacterData(this->_buffer.substr(start + 9, end - start - 9));
+            this->_position = this->_resume = end + 3;
+        }
+        // <?...?>, quotes mean nothing in a processing instruction
+        else if (instruction > 0)
+        {
+            if (from < start + 2) from = start + 2;
+            size_t end = this->_buffer.find("?>", from);
+            if (end == string::npos)
+            {
+                this->_resume = this->_buffer.size() - 1;
+                return;
+            }
+            this->_tokenStart = start;
+            this->_tokenEnd = end + 2;
+            this->ParseTag(end + 1);
+            this->_position = this->_resume = end + 2;
+        }
+        // <!...>, <...> & <.../>
+        else
+        {
+            // A split tag is scanned on from where the previous chunk ended, with the quote state kept
+            size_t end = start + 1;
+            if (from > end)
+                end = from;
+            else
+            {
+                this->_tagQuote = 0;
+                this->_tagSubset = 0;
+            }
+
+            // The internal subset of <!DOCTYPE x [ ... ]> holds > characters of its own
+            bool markup = (this->_buffer[start + 1] == '!');
+            while (end < this->_buffer.size())
+            {
+                char c = this->_buffer[end];
+                if (this->_tagQuote != 0)
+                {
+                    if (c == this->_tagQuote) this->_tagQuote = 0;
+                }
+                else if (c == '\"' || c == '\'')
+                    this->_tagQuote = c;
+                else if (c == '[' && markup)
+                    this->_tagSubset++;
+                else if (c == ']' && this->_tagSubset > 0)
+                    this->_tagSubset--;
+                else if (c == '>' && this->_tagSubset == 0)
+                    break;
+                end++;
+            }
+            if (end >= this->_buffer.size())
+            {
+                this->_resume = end;
+                return;
+            }
+
+            this->_tokenStart = start;
+            this->_tokenEnd = end + 1;
+            this->ParseTag(end);
+            this->_position = this->_resume = end + 1;
+        }
+    }
+}
+
+void XmlPushParser::ParseTag(size_t end)
+{
+    string tag = this->_buffer.substr(this->_position, end + 1 - this->_position);
+    priv::XmlParser parser(tag);
+    bool declaration = (tag.compare(0, 5, "<?xml") == 0 && tag.size() > 5 && ((unsigned char)tag[5] <= ' ' || tag[5] == '?'));
+
+    // <!DOCTYPE ...> and processing instructions other than <?xml ?> are skipped
+    if ((tag[1] == '!' || tag[1] == '?') && declaration == false)
+        return;
+
+    // <?xml ?>
+    if (declaration)
+    {
+        vector<string> tokens;
+        string token = parser.NextToken();    // skip <?xml
+        while (token != "?>" && parser.HasToken())
+        {
+            if (token.empty())
+                return this->Fail(XmlParseUnexpectedToken, "?>", string(1, parser.Character()));
+            tokens.push_back(token);
+            token = parser.NextToken();
+        }
+        this->OnDeclaration(tokens);
+    }
+    // </...
+    else if (parser.CurrentToken() == "</")
+    {
+        string localname = parser.NextToken();    // skip </
+        if (this->_openElements.empty())
+            return this->Fail(XmlParseUnexpectedClosingTag, "<", localname);
+        if (localname != this->_openElements.back())
+            return this->Fail(XmlParseWrongClosingTag, this->_openElements.back(), localname);
+        string token = parser.NextToken();
+        if (token != ">")
+            return this->Fail(XmlParseUnexpectedToken, ">", token.empty() ? string(1, parser.Character()) : token);
+
+        this->_openElements.pop_back();
+        this->OnEndElement(localname);
+    }
+    // <...> & <.../>
+    else if (parser.CurrentToken() == "<")
+    {
+        vector<string> tokens;
+        string token = parser.NextToken();   // skip <
+        while (token != ">" && token != "/>" && parser.HasToken())
+        {
+            // A / that is not part of /> is no token at all, and would never be skipped
+            if (token.empty())
+                return this->Fail(XmlParseUnexpectedToken, ">", string(1, parser.Character()));
+            tokens.push_back(token);
+            token = parser.NextToken();
+        }
+
+        if (tokens.size() >= 1)
+        {
+            this->_openElements.push_back(tokens[0]);
+            this->OnStartElement(tokens);
+            if (this->_result.error != XmlParseOk)
+                return;
+            if (token == "/>")
+            {
+                this->_openElements.pop_back();
+                this->OnEndElement(tokens[0]);
+            }
+        }
+        else
+            this->Fail(XmlParseUnexpectedToken, "element name", token);
+    }
+}
+
+void XmlPushParser::OnDeclaration(const vector<string>& tokens)
+{
+    if (this->_document == 0)
+        return;
+
+    if (this->_document->_declaration != 0 || this->_document->_documentElement != 0)
+        return this->Fail(XmlParseMisplacedDeclaration, "<");
+
+    this->_document->_declaration = new XmlDeclaration(this->_document, tokens);
+}
+
+void XmlPushParser::OnStartElement(const vector<string>& tokens)
+{
+    if (this->_document == 0)
+        return;
+
+    XmlNode* parentNode = (this->_openNodes.empty() ? 0 : this->_openNodes.back());
+    XmlNode* node = new XmlNode(this->_document, parentNode, tokens[0]);
+    node->_attributes = XmlNode::_LoadAttributes(this->_document, node, tokens);
+
+    if (parentNode != 0)
+        parentNode->_childNodes.push_back(node);
+    else if (this->_document->_documentElement == 0)
+        this->_document->_documentElement = node;
+    else
+    {
+        delete node;
+        return this->Fail(XmlParseMultipleDocumentElements, "end of document", tokens[0]);
+    }
+
+    this->_openNodes.push_back(node);
+}
+
+void XmlPushParser::OnEndElement(const string& localname)
+{
+    if (this->_document == 0)
+        return;
+
+    this->_openNodes.pop_back();
+}
+
+void XmlPushParser::OnText(const string& text)
+{
+    if (this->_document == 0)
+        return;
+
+    // Only whitespace, which never gets here, may surround the document element
+    if (this->_openNodes.empty())
+        return this->Fail(XmlParseUnexpectedToken, "<", text);
+
+    XmlNode* parentNode = this->_openNodes.back();
+    parentNode->_childNodes.push_back(new XmlText(this->_document, parentNode, text));
+}
+
+void XmlPushParser::OnCharacterData(const string& data)
+{
+    if (this->_document == 0 || this->_openNodes.empty())
+        return;
+
+    XmlNode* parentNode = this->_openNodes.back();
+    parentNode->_childNodes.push_back(new XmlCharacterData(this->_document, parentNode, data));
+}
+
+void XmlPushParser::OnComment(const string& comment)
+{
+    if (this->_document == 0 || this->_openNodes.empty())
+        return;
+
+    XmlNode* parentNode = this->_openNodes.back();
+    parentNode->_childNodes.push_back(new XmlComment(this->_document, parentNode, comment));
+}
@@ -103,55 +103,144 @@ XmlNode* Match(XmlNode* item, const char* xpath)
     return 0;
 }
 
-XmlNodeList XmlNode::SelectNodes(const string& sxpath)
+// Tries every node of the tree, attributes included, as the start of a // expression
+static void MatchDescendants(XmlNode* item, const char* xpath, XmlNodeList& matches)
 {
-    XmlNodeList matches;
+    XmlNodeList childResults = Matches(item, xpath);
+    matches.insert(matches.end(), childResults.begin(), childResults.end());
+
+    for (XmlAttributeCollection::iterator i = item->Attributes().begin(); i != item->Attributes().end(); ++i)
+    {
+        childResults = Matches(i->second, xpath);
+        matches.insert(matches.end(), childResults.begin(), childResults.end());
+    }
+
+    for (XmlNodeList::iterator i = item->ChildNodes().begin(); i != item->ChildNodes().end(); ++i)
+        MatchDescendants(*i, xpath, matches);
+}
 
-    const char* xpath = sxpath.c_str();
+static XmlNode* MatchDescendant(XmlNode* item, const char* xpath)
+{
+    XmlNode* match = Match(item, xpath);
+    if (match != 0)
+        return match;
+
+    for (XmlAttributeCollection::iterator i = item->Attributes().begin(); i != item->Attributes().end() && match == 0; ++i)
+        match = Match(i->second, xpath);
 
+    for (XmlNodeList::iterator i = item->ChildNodes().begin(); i != item->ChildNodes().end() && match == 0; ++i)
+        match = MatchDescendant(*i, xpath);
+
+    return match;
+}
+
+static XmlNodeList* FindCached(XmlDocument* document, const XmlXPathCacheKey& key)
+{
+    // Any change to the document makes all cached results stale
+    if (document->_xpathCacheGeneration != document->_generation)
+    {
+        document->_xpathCache.clear();
+        document->_xpathCacheOrder.clear();
+        document->_xpathCacheGeneration = document->_generation;
+        return 0;
+    }
+
+    map<XmlXPathCacheKey, XmlNodeList>::iterator found = document->_xpathCache.find(key);
+    if (found == document->_xpathCache.end())
+        return 0;
+
+    return &found->second;
+}
+
+static void AddCached(XmlDocument* document, const XmlXPathCacheKey& key, const XmlNodeList& matches)
+{
+    // Oldest results are dropped first once the cache is full
+    while (document->_xpathCacheOrder.size() >= document->_xpathCacheSize)
+    {
+        document->_xpathCache.erase(document->_xpathCacheOrder.front());
+        document->_xpathCacheOrder.pop_front();
+    }
+
+    document->_xpathCache.insert(make_pair(key, matches));
+    document->_xpathCacheOrder.push_back(key);
+}
+
+static XmlNodeList SelectNodes(XmlNode* context, const char* xpath)
+{
+    XmlNodeList matches;
+    XmlDocument* document = context->OwnerDocument();
+
+    // Only nodes in the tree are searched, detached clones are left out
     if (xpath[0] == '/' && xpath[1] == '/')
     {
-        for (set<XmlNode*>::iterator i = this->_ownerDocument->_nodes.begin(); i != this->_ownerDocument->_nodes.end(); ++i)
-        {
-            XmlNodeList childResults = Matches(*i, xpath+2);
-            matches.insert(matches.end(), childResults.begin(), childResults.end());
-        }
+        if (document->_documentElement != 0)
+            MatchDescendants(document->_documentElement, xpath+2, matches);
     }
     else if (xpath[0] == '/')
     {
-        XmlNodeList childResults = Matches(this->_ownerDocument->_documentElement, xpath+1);
+        if (document->_documentElement == 0)
+            return matches;
+        XmlNodeList childResults = Matches(document->_documentElement, xpath+1);
         matches.insert(matches.end(), childResults.begin(), childResults.end());
     }
     else
     {
-        XmlNodeList childResults = Matches(this, xpath);
+        XmlNodeList childResults = Matches(context, xpath);
         matches.insert(matches.end(), childResults.begin(), childResults.end());
     }
 
     return matches;
 }
 
-XmlNode* XmlNode::SelectSingleNode(const string& sxpath)
+static XmlNode* SelectSingleNode(XmlNode* context, const char* xpath)
 {
-    const char* xpath = sxpath.c_str();
+    XmlDocument* document = context->OwnerDocument();
+
+    if (document->_documentElement == 0 && xpath[0] == '/')
+        return 0;
 
     if (xpath[0] == '/' && xpath[1] == '/')
-    {
-        for (set<XmlNode*>::iterator i = this->_ownerDocument->_nodes.begin(); i != this->_ownerDocument->_nodes.end(); ++i)
-        {
-            XmlNode* childResult = Match(*i, xpath+2);
-            if (childResult != 0)
-                return childResult;
-        }
-    }
+        return MatchDescendant(document->_documentElement, xpath+2);
     else if (xpath[0] == '/')
-        return Match(this->_ownerDocument->_documentElement, xpath+1);
+        return Match(document->_documentElement, xpath+1);
     else
-        return Match(this, xpath);
+        return Match(context, xpath);
 
     return 0;
 }
 
+XmlNodeList XmlNode::SelectNodes(const string& xpath)
+{
+    if (this->_ownerDocument == 0 || this->_ownerDocument->_xpathCacheSize == 0)
+        return ::SelectNodes(this, xpath.c_str());
+
+    XmlXPathCacheKey key(make_pair(this, false), xpath);
+    XmlNodeList* cached = FindCached(this->_ownerDocument, key);
+    if (cached != 0)
+        return *cached;
+
+    XmlNodeList matches = ::SelectNodes(this, xpath.c_str());
+    AddCached(this->_ownerDocument, key, matches);
+
+    return matches;
+}
+
+XmlNode* XmlNode::SelectSingleNode(const string& xpath)
+{
+    if (this->_ownerDocument == 0 || this->_ownerDocument->_xpathCacheSize == 0)
+        return ::SelectSingleNode(this, xpath.c_str());
+
+    XmlXPathCacheKey key(make_pair(this, true), xpath);
+    XmlNodeList* cached = FindCached(this->_ownerDocument, key);
+    if (cached != 0)
+        return (cached->empty() ? 0 : cached->front());
+
+    XmlNode* match = ::SelectSingleNode(this, xpath.c_str());
+    AddCached(this->_ownerDocument, key, (match != 0 ? XmlNodeList(1, match) : XmlNodeList()));
+
+    return match;
+}
+
 XmlNodeList XmlDocument::SelectNodes(const std::string& xpath)
 {
     if (this->_documentElement != 0)
@@ -165,3 +254,13 @@ XmlNode* XmlDocument::SelectSingleNode(const std::string& xpath)
         return this->_documentElement->SelectSingleNode(xpath);
     return 0;
 }
+
+void XmlDocument::XPathCacheSize(size_t size)
+{
+    this->_xpathCacheSize = size;
+    while (this->_xpathCacheOrder.size() > size)
+    {
+        this->_xpathCache.erase(this->_xpathCacheOrder.front());
+        this->_xpathCacheOrder.pop_front();
+    }
+}